@@ -38,7 +38,7 @@ static int16_t alaw_to_s16 (uint8_t a_val)
 	return ((a_val & 0x80) ? t : -t);
 }
 
-void alaw_decode(int16_t *samples, uint8_t *alaw, int nr)
+void alaw_decode_ref(int16_t *samples, uint8_t *alaw, int nr)
 {
 	int i;
 	
@@ -87,11 +87,23 @@ static int val_seg (int val)
 }
 
 
-static uint8_t s16_to_alaw (int16_t pcm_val)
+/* A-law code for a magnitude, without the sign and inversion mask */
+static uint8_t mag_to_alaw (int pcm_val)
 {
 	int seg;
+
+	if (pcm_val < 256)
+		return pcm_val >> 4;
+
+	/* Convert the scaled magnitude to segment number. */
+	seg = val_seg (pcm_val);
+	return (seg << 4) | ((pcm_val >> (seg + 3)) & 0x0f);
+}
+
+static uint8_t s16_to_alaw (int16_t sample)
+{
+	int pcm_val = sample;
 	uint8_t mask;
-	uint8_t aval;
 
 	if (pcm_val >= 0) {
 		mask = 0xD5;
@@ -102,14 +114,45 @@ static uint8_t s16_to_alaw (int16_t pcm_val)
 			pcm_val = 0x7fff;
 	}
 
-	if (pcm_val < 256)
-		aval = pcm_val >> 4;
-	else {
-		/* Convert the scaled magnitude to segment number. */
-		seg = val_seg (pcm_val);
-		aval = (seg << 4) | ((pcm_val >> (seg + 3)) & 0x0f);
+	return mag_to_alaw (pcm_val) ^ mask;
+}
+
+void alaw_encode_ref(uint8_t *alaw, int16_t *samples, int nr)
+{
+	int i;
+	
+	for (i = 0; i < nr; i++) {
+		alaw[i] = s16_to_alaw(samples[i]);
+	}
+}
+
+/*
+ * Table driven versions, the tables are filled from the code above when
+ * the library is loaded.
+ * The code only depends on the sign and the top 11 bits of the
+ * magnitude, so encoding is a lookup in a 2k table.
+ */
+
+static int16_t alaw_decode_table[256];
+static uint8_t alaw_encode_table[0x8000 >> 4];
+
+static void __attribute__((constructor)) alaw_tables_init (void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++)
+		alaw_decode_table[i] = alaw_to_s16(i);
+	for (i = 0; i < sizeof(alaw_encode_table); i++)
+		alaw_encode_table[i] = mag_to_alaw(i << 4);
+}
+
+void alaw_decode(int16_t *samples, uint8_t *alaw, int nr)
+{
+	int i;
+	
+	for (i = 0; i < nr; i++) {
+		samples[i] = alaw_decode_table[alaw[i]];
 	}
-	return aval ^ mask;
 }
 
 void alaw_encode(uint8_t *alaw, int16_t *samples, int nr)
@@ -117,6 +160,13 @@ void alaw_encode(uint8_t *alaw, int16_t *samples, int nr)
 	int i;
 	
 	for (i = 0; i < nr; i++) {
-		alaw[i] = s16_to_alaw(samples[i]);
+		int pcm_val = samples[i];
+		/* 0 or -1, without branches */
+		int sign = pcm_val >> 31;
+		int mag = (pcm_val ^ sign) - sign;
+
+		/* -32768 */
+		mag -= mag >> 15;
+		alaw[i] = alaw_encode_table[mag >> 4] ^ (0xD5 ^ (sign & 0x80));
 	}
 }
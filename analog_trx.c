@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <poll.h>
+#include <signal.h>
 #include <sched.h>
 #include <errno.h>
 #include <string.h>
@@ -49,6 +50,15 @@ static int16_t *samples_rx;
 static int nr_rx;
 
 static uint8_t mac[6];
+static struct interface *iface;
+
+/* Dump the interface statistics on SIGUSR1 */
+static volatile sig_atomic_t stats_dump;
+
+static void stats_signal(int sig)
+{
+	stats_dump = 1;
+}
 static uint8_t bcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
 
 static struct sound_resample *sr_out = NULL;
@@ -114,7 +124,7 @@ static void cb_control(char *ctrl)
 	
 	printf("Control: %s\n", ctrl);
 	
-	interface_rx(bcast, mac, ETH_P_AR_CONTROL, msg, strlen(ctrl), 0, 1);
+	interface_rx(iface, bcast, mac, ETH_P_AR_CONTROL, msg, strlen(ctrl), 0, 1);
 }
 
 
@@ -167,7 +177,7 @@ static void cb_sound_in(int16_t *hw_samples, int16_t *samples_r, int hw_nr, int
 					pass |= energy_squelch_state(energy, nr_samples);
 				}
 				if (pass)
-					interface_rx(bcast, mac, rx_type, packed_codec_bits, bytes_per_codec_frame, 0, 1);
+					interface_rx(iface, bcast, mac, rx_type, packed_codec_bits, bytes_per_codec_frame, 0, 1);
 
 				nr_rx = 0;
 			}
@@ -180,7 +190,7 @@ static void cb_sound_in(int16_t *hw_samples, int16_t *samples_r, int hw_nr, int
 		
 			alaw_encode(alaw, samples, nr);
 		
-			interface_rx(bcast, mac, ETH_P_ALAW, alaw, nr, 0, 1);
+			interface_rx(iface, bcast, mac, ETH_P_ALAW, alaw, nr, 0, 1);
 		}
 	}
 }
@@ -341,7 +351,6 @@ int main(int argc, char **argv)
 	char *netname = "analog";
 	char *inputdev = NULL;
 	bool inputtoggle = false;
-	int fd_int;
 	struct pollfd *fds;
 	int sound_fdc_tx;
 	int sound_fdc_rx;
@@ -481,7 +490,15 @@ int main(int argc, char **argv)
 	samples_rx = calloc(nr_samples, sizeof(samples_rx[0]));
 	tx_data = calloc(16, sizeof(uint8_t));
 
-	fd_int = interface_init(netname, mac, tap, 0);
+	iface = interface_init(netname, mac, tap, 0);
+	if (iface) {
+		/* Only voice frames are of interest */
+		struct interface_filter filter = { 0 };
+		interface_filter_add_voice(&filter);
+		interface_filter_set(iface, &filter);
+
+		interface_rx_queue(iface, true);
+	}
 	if ((rate = sound_init(sounddev, cb_sound_in, rate, 0, 0)) < 0) {
 		printf("Could not open sound device\n");
 		return -1;
@@ -525,7 +542,7 @@ int main(int argc, char **argv)
 
 	prio();
 	
-	if (fd_int < 0) {
+	if (!iface) {
 		printf("Could not create interface\n");
 		return -1;
 	}
@@ -540,11 +557,12 @@ int main(int argc, char **argv)
 	sound_poll_fill_tx(fds, sound_fdc_tx);
 	sound_poll_fill_rx(fds + sound_fdc_tx, sound_fdc_rx);
 	poll_int = sound_fdc_tx + sound_fdc_rx;
-	fds[poll_int].fd = fd_int;
+	fds[poll_int].fd = interface_fd(iface);
 	fds[poll_int].events = POLLIN;
 	poll_io = poll_int + 1;
 	io_poll_fill(fds + poll_io, io_fdc);
 
+	signal(SIGUSR1, stats_signal);
 
 	do {
 		poll(fds, nfds, -1);
@@ -555,9 +573,15 @@ int main(int argc, char **argv)
 			sound_rx();
 		}
 		if (fds[poll_int].revents & POLLIN) {
-			interface_tx(cb_int_tx);
+			interface_tx_burst(iface, cb_int_tx, INTERFACE_BURST_MAX);
 		}
 		io_handle(fds + poll_io, io_fdc, cb_control);
+		interface_rx_flush(iface);
+
+		if (stats_dump) {
+			stats_dump = 0;
+			interface_stats_print(iface, netname);
+		}
 	} while (1);
 	
 	
@@ -24,4 +24,9 @@
 void alaw_decode(int16_t *samples, uint8_t *alaw, int nr);
 void alaw_encode(uint8_t *alaw, int16_t *samples, int nr);
 
+/* Straightforward versions, the ones above are table driven and should
+   give exactly the same results */
+void alaw_decode_ref(int16_t *samples, uint8_t *alaw, int nr);
+void alaw_encode_ref(uint8_t *alaw, int16_t *samples, int nr);
+
 #endif /* _INCLUDE_ETHAR_ALAW_H_ */
@@ -24,4 +24,9 @@
 void ulaw_decode(int16_t *samples, uint8_t *ulaw, int nr);
 void ulaw_encode(uint8_t *ulaw, int16_t *samples, int nr);
 
+/* Straightforward versions, the ones above are table driven and should
+   give exactly the same results */
+void ulaw_decode_ref(int16_t *samples, uint8_t *ulaw, int nr);
+void ulaw_encode_ref(uint8_t *ulaw, int16_t *samples, int nr);
+
 #endif /* _INCLUDE_ETHAR_ULAW_H_ */
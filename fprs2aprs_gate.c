@@ -20,6 +20,7 @@
 #include <eth_ar/eth_ar.h>
 
 #include <poll.h>
+#include <signal.h>
 #include <errno.h>
 #include <ctype.h>
 #include <unistd.h>
@@ -45,7 +46,6 @@
 
 static char *call = NULL;
 static int fd_is = -1;
-static int fd_int = -1;
 
 int tcp_connect(char *host, int port)
 {
@@ -185,17 +185,28 @@ static int cb_int_tx(uint8_t to[6], uint8_t from[6], uint16_t eth_type, uint8_t
 
 
 
+#define INTERFACES_MAX	16
+
 char *netname = "freedv";
 char *host = "euro.aprs2.net";
 int port = 14580;
 
+/* Dump the interface statistics on SIGUSR1 */
+static volatile sig_atomic_t stats_dump;
+
+static void stats_signal(int sig)
+{
+	stats_dump = 1;
+}
+
 static void usage(void)
 {
 	printf("Options:\n");
 	printf("-v\tverbose\n");
 	printf("-c [call]\town callsign\n");
 	printf("-h [host]\tAPRS-IS server (default: \"%s\")\n", host);
-	printf("-n [dev]\tNetwork device name (default: \"%s\")\n", netname);
+	printf("-m\tUse memory mapped receive ring\n");
+	printf("-n [dev]\tNetwork device name, may be repeated (default: \"%s\")\n", netname);
 	printf("-p [port]\tAPRS-IS port (default: %d)\n", port);
 }
 
@@ -205,8 +216,13 @@ int main(int argc, char **argv)
 	int nfds;
 	int poll_int, poll_is;
 	int opt;
+	char *netnames[INTERFACES_MAX];
+	struct interface *iface[INTERFACES_MAX] = { NULL };
+	int nr_iface = 0;
+	bool ring = false;
+	int i;
 	
-	while ((opt = getopt(argc, argv, "c:n:h:i:p:")) != -1) {
+	while ((opt = getopt(argc, argv, "c:n:h:i:mp:")) != -1) {
 		switch(opt) {
 			case 'c':
 				call = optarg;
@@ -214,11 +230,16 @@ int main(int argc, char **argv)
 			case 'h':
 				host = optarg;
 				break;
+			case 'm':
+				ring = true;
+				break;
 			case 'p':
 				port = atoi(optarg);
 				break;
 			case 'n':
-				netname = optarg;
+				if (nr_iface == INTERFACES_MAX)
+					goto err_usage;
+				netnames[nr_iface++] = optarg;
 				break;
 			default:
 				goto err_usage;
@@ -236,24 +257,38 @@ int main(int argc, char **argv)
 		}
 	}
 
-	nfds = 1 + 1;
+	if (!nr_iface)
+		netnames[nr_iface++] = netname;
+
+	nfds = 1 + nr_iface;
 	fds = calloc(sizeof(struct pollfd), nfds);
 
-	poll_int = 0;
-	fds[poll_int].fd = -1;
-	fds[poll_int].events = POLLIN;
-	poll_is = 1;
+	poll_is = 0;
 	fds[poll_is].fd = -1;
 	fds[poll_is].events = POLLIN;
-	
+	poll_int = 1;
+	for (i = 0; i < nr_iface; i++) {
+		fds[poll_int + i].fd = -1;
+		fds[poll_int + i].events = POLLIN;
+	}
+
+	struct interface_filter filter = { 0 };
+	interface_filter_add_type(&filter, ETH_P_FPRS, ETH_P_FPRS);
+
+	signal(SIGUSR1, stats_signal);
 
 	do {
-		if (fd_int < 0) {
-			fd_int = interface_init(netname, NULL, false, ETH_P_FPRS);
-			if (fd_int < 0) {
-				printf("Could not open interface: %s\n", strerror(errno));
+		for (i = 0; i < nr_iface; i++) {
+			if (iface[i])
+				continue;
+			iface[i] = interface_init(netnames[i], NULL, false, ETH_P_FPRS);
+			if (!iface[i]) {
+				printf("Could not open interface %s: %s\n", netnames[i], strerror(errno));
 			} else {
-				fds[poll_int].fd = fd_int;
+				interface_filter_set(iface[i], &filter);
+				if (ring)
+					interface_tx_ring(iface[i], true);
+				fds[poll_int + i].fd = interface_fd(iface[i]);
 			}
 		}
 		if (fd_is < 0) {
@@ -273,12 +308,14 @@ int main(int argc, char **argv)
 			}
 		}
 		poll(fds, nfds, 1000);
-		if (fds[poll_int].revents & (POLLIN | POLLERR)) {
-			if (interface_tx_raw(cb_int_tx)) {
-				printf("Interface lost\n");
-				close(fd_int);
-				fd_int = -1;
-				fds[poll_int].fd = -1;
+		for (i = 0; i < nr_iface; i++) {
+			if (!(fds[poll_int + i].revents & (POLLIN | POLLERR)))
+				continue;
+			if (interface_tx_raw_burst(iface[i], cb_int_tx, INTERFACE_BURST_MAX) < 0) {
+				printf("Interface %s lost\n", netnames[i]);
+				interface_close(iface[i]);
+				iface[i] = NULL;
+				fds[poll_int + i].fd = -1;
 			}
 		}
 		if (fds[poll_is].revents & (POLLIN | POLLERR)) {
@@ -289,6 +326,13 @@ int main(int argc, char **argv)
 				fds[poll_is].fd = -1;
 			}
 		}
+		if (stats_dump) {
+			stats_dump = 0;
+			for (i = 0; i < nr_iface; i++) {
+				if (iface[i])
+					interface_stats_print(iface[i], netnames[i]);
+			}
+		}
 	} while (1);
 
 	return 0;
@@ -77,6 +77,7 @@ static void usage(void)
 int main(int argc, char **argv)
 {
 	int opt;
+	struct interface *iface;
 	int fd_int;
 	uint8_t bcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
 	uint8_t myaddr[6];
@@ -104,11 +105,12 @@ int main(int argc, char **argv)
 		}
 	}
 
-	fd_int = interface_init(netname, NULL, false, ETH_P_FPRS);
-	if (fd_int < 0) {
+	iface = interface_init(netname, NULL, false, ETH_P_FPRS);
+	if (!iface) {
 		printf("Could not open interface: %s\n", strerror(errno));
 		return -1;
 	}
+	fd_int = interface_fd(iface);
 
 	if (!call || eth_ar_callssid2mac(myaddr, call, false)) {
 		printf("From callsign could not be converted to a valid MAC address\n");
@@ -134,7 +136,7 @@ int main(int argc, char **argv)
 		if (!data)
 			goto err_fatal;
 		fprs_frame_data_get(frame, data, &size);
-		interface_rx_raw(bcast, myaddr, ETH_P_FPRS, data, size);
+		interface_rx_raw(iface, bcast, myaddr, ETH_P_FPRS, data, size);
 		free(data);
 		
 		return 0;
@@ -158,7 +160,7 @@ int main(int argc, char **argv)
 		select(fd_int + 1, &fdr, NULL, NULL, &timeout);
 
 		if (FD_ISSET(fd_int, &fdr)) {
-			interface_tx_raw(cb);
+			interface_tx_raw(iface, cb);
 		}
 	} while (!done && time(NULL) < stop_listen);
 
@@ -30,6 +30,7 @@
 
 
 static char *netname = "freedv";
+static struct interface *iface;
 
 
 static void usage(void)
@@ -108,7 +109,7 @@ void handle_gps(void)
 		goto err_fatal;
 	fprs_frame_data_get(frame, data, &size);
 
-	interface_rx_raw(bcast, myaddr, ETH_P_FPRS, data, size);
+	interface_rx_raw(iface, bcast, myaddr, ETH_P_FPRS, data, size);
 
 	free(data);
 
@@ -125,7 +126,6 @@ no_update:
 int main(int argc, char **argv)
 {
 	int opt;
-	int fd_int;
 	char *call = NULL;
 
 	while ((opt = getopt(argc, argv, "c:i:e:s:")) != -1) {
@@ -145,8 +145,8 @@ int main(int argc, char **argv)
 		}
 	}
 
-	fd_int = interface_init(netname, NULL, false, ETH_P_FPRS);
-	if (fd_int < 0) {
+	iface = interface_init(netname, NULL, false, ETH_P_FPRS);
+	if (!iface) {
 		printf("Could not open interface: %s\n", strerror(errno));
 		return -1;
 	}
@@ -24,7 +24,9 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
-#include <sys/select.h>
+#include <poll.h>
+
+#define INTERFACES_MAX	16
 
 static char *netname = "freedv";
 
@@ -55,20 +57,33 @@ static int cb(uint8_t to[6], uint8_t from[6], uint16_t eth_type, uint8_t *data,
 static void usage(void)
 {
 	printf("Options:\n");
-	printf("-i [dev]\tNetwork device name (default: \"%s\")\n", netname);
+	printf("-i [dev]\tNetwork device name, may be repeated (default: \"%s\")\n", netname);
+	printf("-m\tUse memory mapped receive ring\n");
+	printf("-t\tAlso show outgoing frames\n");
 }
 
 
 int main(int argc, char **argv)
 {
 	int opt;
-	int fd_int;
+	char *netnames[INTERFACES_MAX];
+	struct interface *iface[INTERFACES_MAX];
+	struct pollfd fds[INTERFACES_MAX];
+	int nr_iface = 0;
+	int nr_active;
+	int i;
 	bool outgoing = false;
+	bool ring = false;
 	
-	while ((opt = getopt(argc, argv, "i:t")) != -1) {
+	while ((opt = getopt(argc, argv, "i:mt")) != -1) {
 		switch(opt) {
 			case 'i':
-				netname = optarg;
+				if (nr_iface == INTERFACES_MAX)
+					goto err_usage;
+				netnames[nr_iface++] = optarg;
+				break;
+			case 'm':
+				ring = true;
 				break;
 			case 't':
 				outgoing = true;
@@ -78,26 +93,43 @@ int main(int argc, char **argv)
 		}
 	}
 
-	fd_int = interface_init(netname, NULL, false, ETH_P_FPRS);
-	if (fd_int < 0) {
-		printf("Could not open interface: %s\n", strerror(errno));
-		return -1;
-	}
-	
-	interface_tx_outgoing(outgoing);
+	if (!nr_iface)
+		netnames[nr_iface++] = netname;
 
-	do {
-		fd_set fdr;
-		
-		FD_ZERO(&fdr);
-		FD_SET(fd_int, &fdr);
+	struct interface_filter filter = { 0 };
+	interface_filter_add_type(&filter, ETH_P_FPRS, ETH_P_FPRS);
+
+	for (i = 0; i < nr_iface; i++) {
+		iface[i] = interface_init(netnames[i], NULL, false, ETH_P_FPRS);
+		if (!iface[i]) {
+			printf("Could not open interface %s: %s\n", netnames[i], strerror(errno));
+			return -1;
+		}
+		interface_filter_set(iface[i], &filter);
+		interface_tx_outgoing(iface[i], outgoing);
+		if (ring)
+			interface_tx_ring(iface[i], true);
 		
-		select(fd_int + 1, &fdr, NULL, NULL, NULL);
+		fds[i].fd = interface_fd(iface[i]);
+		fds[i].events = POLLIN;
+	}
 
-		if (FD_ISSET(fd_int, &fdr)) {
-			interface_tx_raw(cb);
+	/* Stop when all interfaces are gone, e.g. at the end of a capture */
+	nr_active = nr_iface;
+	do {
+		poll(fds, nr_iface, -1);
+
+		for (i = 0; i < nr_iface; i++) {
+			if (!(fds[i].revents & POLLIN))
+				continue;
+			if (interface_tx_raw_burst(iface[i], cb, INTERFACE_BURST_MAX) < 0) {
+				printf("Interface %s lost\n", netnames[i]);
+				interface_close(iface[i]);
+				fds[i].fd = -1;
+				nr_active--;
+			}
 		}
-	} while (1);
+	} while (nr_active);
 
 	return 0;
 
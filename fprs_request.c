@@ -67,6 +67,7 @@ static void usage(void)
 	printf("Options:\n");
 	printf("-e [element]\telement type\n");
 	printf("-c [call]\town callsign\n");
+	printf("-m\tUse memory mapped receive ring\n");
 	printf("-t [call]\ttarget callsign\n");
 	printf("-n [dev]\tNetwork device name (default: \"%s\")\n", netname);
 }
@@ -75,7 +76,9 @@ static void usage(void)
 int main(int argc, char **argv)
 {
 	int opt;
+	struct interface *iface;
 	int fd_int;
+	bool ring = false;
 	uint8_t bcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
 	uint8_t myaddr[6];
 	char *call = NULL;
@@ -84,11 +87,14 @@ int main(int argc, char **argv)
 	time_t interval = 10;
 	time_t retry;
 	
-	while ((opt = getopt(argc, argv, "c:n:t:e:")) != -1) {
+	while ((opt = getopt(argc, argv, "c:mn:t:e:")) != -1) {
 		switch(opt) {
 			case 'c':
 				call = optarg;
 				break;
+			case 'm':
+				ring = true;
+				break;
 			case 'e':
 				el = atoi(optarg);
 				break;
@@ -103,11 +109,14 @@ int main(int argc, char **argv)
 		}
 	}
 
-	fd_int = interface_init(netname, NULL, false, ETH_P_FPRS);
-	if (fd_int < 0) {
+	iface = interface_init(netname, NULL, false, ETH_P_FPRS);
+	if (!iface) {
 		printf("Could not open interface: %s\n", strerror(errno));
 		return -1;
 	}
+	fd_int = interface_fd(iface);
+	if (ring)
+		interface_tx_ring(iface, true);
 
 	if (!call || eth_ar_callssid2mac(myaddr, call, false)) {
 		printf("From callsign could not be converted to a valid MAC address\n");
@@ -118,6 +127,13 @@ int main(int argc, char **argv)
 		goto err_usage;
 	}
 
+	/* Don't wake up for our own requests */
+	struct interface_filter filter = { 0 };
+	interface_filter_add_type(&filter, ETH_P_FPRS, ETH_P_FPRS);
+	filter.exclude_from = true;
+	memcpy(filter.from, myaddr, 6);
+	interface_filter_set(iface, &filter);
+
 	struct fprs_frame *frame = fprs_frame_create();
 	
 	fprs_frame_add_callsign(frame, myaddr);
@@ -154,10 +170,10 @@ int main(int argc, char **argv)
 		select(fd_int + 1, &fdr, NULL, NULL, &timeout);
 
 		if (FD_ISSET(fd_int, &fdr)) {
-			interface_tx_raw(cb);
+			interface_tx_raw(iface, cb);
 		}
 		if (!done) {
-			interface_rx_raw(bcast, myaddr, ETH_P_FPRS, data, size);
+			interface_rx_raw(iface, bcast, myaddr, ETH_P_FPRS, data, size);
 			retry += interval;
 		}
 	} while (!done && time(NULL) < stop_listen);
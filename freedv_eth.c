@@ -15,12 +15,15 @@
 	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <poll.h>
+#include <signal.h>
 #include <sched.h>
+#include <pthread.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
@@ -66,9 +69,37 @@ static bool freedv_hasdata;
 static uint8_t mac[ETH_AR_MAC_SIZE];
 
 static struct freedv_eth_transcode *tc = NULL;
-static struct freedv_eth_transcode *tc_iface = NULL;
+/* Used for local rx, tc is used for the network side */
+static struct freedv_eth_transcode *tc_rx = NULL;
 
 static struct nmea_state *nmea;
+static struct interface *iface;
+
+/* With threads enabled the main thread only does tx, the network and
+   sound input are handled by their own threads and reach the tx queues
+   through these rings. */
+static struct tx_ring *ring_net;
+static struct tx_ring *ring_rx;
+/* Optional threads doing the network voice transcoding */
+static struct transcode_workers *workers;
+
+struct thread_conf {
+	char *name;
+	int priority;
+	int cpu;
+};
+
+static struct thread_conf thread_conf_tx = { "tx" };
+static struct thread_conf thread_conf_rx = { "rx" };
+static struct thread_conf thread_conf_net = { "net" };
+
+/* Dump the interface statistics on SIGUSR1 */
+static volatile sig_atomic_t stats_dump;
+
+static void stats_signal(int sig)
+{
+	stats_dump = 1;
+}
 
 enum tx_mode {
 	TX_MODE_NONE,
@@ -88,56 +119,76 @@ enum rx_mode {
 
 static enum rx_mode rx_mode;
 
+/* Hand an entry to the tx queues, through a ring when the tx queues are
+   owned by another thread */
+static void tx_enqueue(struct tx_ring *ring, struct tx_ring_entry *entry)
+{
+	if (ring)
+		tx_ring_put(ring, entry);
+	else
+		tx_ring_entry_enqueue(entry);
+}
+
 void freedv_eth_voice_rx(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, bool local_rx,
     uint8_t transmission, double level_dbm)
 {
 	struct tx_packet *packet;
 	uint8_t level = eth_ar_dbm_encode(level_dbm);
+	struct freedv_eth_transcode_target target[3];
+	int nr = 0;
+	int voice = -1, baseband = -1, alaw = -1;
 
+	/* Decode once for everything this voice goes to */
 	if (tx_mode != TX_MODE_NONE) {
 		if (repeater || (baseband_in_tx && !local_rx)) {
-			if (len > tx_packet_max())
-				return;
-			packet = tx_packet_alloc();
-			packet->len = len;
-			memcpy(packet->data, data, len);
-			memcpy(packet->from, from, 6);
-		
-			freedv_eth_transcode(tc, packet, tx_codecmode, eth_type);
-
-			packet->local_rx = local_rx;
-			enqueue_voice(packet, 0, -10);
+			voice = nr;
+			target[nr++].codecmode = tx_codecmode;
 		}
 		if (local_rx && baseband_out) {
-			if (len > tx_packet_max())
-				return;
-			packet = tx_packet_alloc();
-			packet->len = len;
-			memcpy(packet->data, data, len);
-			memcpy(packet->from, from, 6);
-		
-			freedv_eth_transcode(tc, packet, CODEC_MODE_NATIVE16, eth_type);
-
-			packet->local_rx = local_rx;
-			enqueue_baseband(packet);
+			baseband = nr;
+			target[nr++].codecmode = CODEC_MODE_NATIVE16;
 		}
 	}
-
 	if (eth_type == ETH_P_NATIVE16) {
-		packet = tx_packet_alloc();
-		packet->len = len;
-		memcpy(packet->data, data, len);
+		alaw = nr;
+		target[nr++].codecmode = CODEC_MODE_ALAW;
+	}
+	if (nr)
+		freedv_eth_transcode_fanout(tc_rx, target, nr, from, eth_type, data, len);
+
+	if (voice >= 0 && target[voice].packet) {
+		packet = target[voice].packet;
 		memcpy(packet->from, from, 6);
-		
-		freedv_eth_transcode(tc_iface, packet, CODEC_MODE_ALAW, eth_type);
+		packet->local_rx = local_rx;
+		tx_enqueue(ring_rx, &(struct tx_ring_entry){
+		    .queue = TX_RING_VOICE, .packet = packet,
+		    .transmission = 0, .level_dbm = -10 });
+	}
+	if (baseband >= 0 && target[baseband].packet) {
+		packet = target[baseband].packet;
+		memcpy(packet->from, from, 6);
+		packet->local_rx = local_rx;
+		tx_enqueue(ring_rx, &(struct tx_ring_entry){
+		    .queue = TX_RING_BASEBAND, .packet = packet });
+	}
 
-		interface_rx(to, from, ETH_P_ALAW, packet->data, packet->len, transmission, level);
+	if (alaw >= 0) {
+		packet = target[alaw].packet;
+		if (!packet)
+			return;
+		interface_rx_headroom(iface, to, from, ETH_P_ALAW, packet->data, packet->len, transmission, level);
 		tx_packet_free(packet);
 	} else {
-		interface_rx(to, from, eth_type, data, len, transmission, level);
+		interface_rx(iface, to, from, eth_type, data, len, transmission, level);
 	}
 }
 
+void freedv_eth_voice_end(uint8_t transmission)
+{
+	tx_enqueue(ring_rx, &(struct tx_ring_entry){
+	    .queue = TX_RING_VOICE_END, .transmission = transmission });
+}
+
 static void cb_sound_in(int16_t *samples_l, int16_t *samples_r, int nr_l, int nr_r)
 {
 	if ((freedv_eth_tx_ptt() || freedv_eth_txa_ptt()) && !fullduplex)
@@ -176,29 +227,48 @@ static int cb_int_tx(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE],
 		return 0;
 	
 	if (eth_ar_eth_p_isvoice(eth_type)) {
-		if (len > tx_packet_max() || len < 2)
+		if (len < 2)
 			return 0;
 		uint8_t transmission = data[0];
 		uint8_t level = data[1];
-		packet = tx_packet_alloc();
-		packet->len = len-2;
-		memcpy(packet->data, data+2, len-2);
-		memcpy(packet->from, from, 6);
-		
-		freedv_eth_transcode(tc, packet, tx_codecmode, eth_type);
-
-		int q = enqueue_voice(packet, transmission, eth_ar_dbm_decode(level));
 
-		if (q && baseband_out) {
-			packet = tx_packet_alloc();
-			packet->len = len-2;
-			memcpy(packet->data, data+2, len-2);
+		if (workers) {
+			packet = tx_packet_alloc(len - 2);
+			if (!packet)
+				return 0;
+			packet->len = len - 2;
+			memcpy(packet->data, data + 2, len - 2);
 			memcpy(packet->from, from, 6);
-		
-			freedv_eth_transcode(tc, packet, CODEC_MODE_NATIVE16, eth_type);
 
-			enqueue_baseband(packet);
+			transcode_workers_put(workers, &(struct tx_ring_entry){
+			    .queue = TX_RING_VOICE, .packet = packet,
+			    .transmission = transmission, .level_dbm = eth_ar_dbm_decode(level),
+			    .eth_type = eth_type });
+			return 0;
+		}
+
+		struct freedv_eth_transcode_target target[2] = {
+			{ .codecmode = tx_codecmode },
+			{ .codecmode = CODEC_MODE_NATIVE16 },
+		};
+		freedv_eth_transcode_fanout(tc, target, baseband_out ? 2 : 1,
+		    from, eth_type, data + 2, len - 2);
+
+		packet = target[0].packet;
+		struct tx_packet *packet_bb = baseband_out ? target[1].packet : NULL;
+		if (!packet) {
+			if (packet_bb)
+				tx_packet_free(packet_bb);
+			return 0;
 		}
+		memcpy(packet->from, from, 6);
+		if (packet_bb)
+			memcpy(packet_bb->from, from, 6);
+
+		/* The baseband copy is only queued if the voice is accepted */
+		tx_enqueue(ring_net, &(struct tx_ring_entry){
+		    .queue = TX_RING_VOICE, .packet = packet, .baseband = packet_bb,
+		    .transmission = transmission, .level_dbm = eth_ar_dbm_decode(level) });
 	} else {
 		if (eth_type == ETH_P_FPRS && !memcmp(mac, from, 6)) {
 			struct fprs_frame *frame = fprs_frame_create();
@@ -219,14 +289,21 @@ static int cb_int_tx(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE],
 //			printf("Data: %d %x\n", eth_type, eth_type);
 			/* TODO: send control as DTMF in analog mode */
 			if (eth_type == ETH_P_AR_CONTROL && vc_control) {
-				packet = tx_packet_alloc();
+				if (len < 2)
+					return 0;
+				packet = tx_packet_alloc(len - 2);
+				if (!packet)
+					return 0;
 				memcpy(packet->data, data + 2, len - 2);
 				packet->len = len -2;
 				packet->off = 0;
 			
-				enqueue_control(packet);
+				tx_enqueue(ring_net, &(struct tx_ring_entry){
+				    .queue = TX_RING_CONTROL, .packet = packet });
 			} else if (freedv_hasdata) {
-				packet = tx_packet_alloc();
+				packet = tx_packet_alloc(len + sizeof(struct ether_header));
+				if (!packet)
+					return 0;
 				struct ether_header *header = (void*)packet->data;
 				packet->len = len + sizeof(struct ether_header);
 				memcpy(header->ether_dhost, to, 6);
@@ -234,7 +311,8 @@ static int cb_int_tx(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE],
 				header->ether_type = htons(eth_type);
 				memcpy(packet->data + sizeof(struct ether_header), data, len);
 
-				enqueue_data(packet);
+				tx_enqueue(ring_net, &(struct tx_ring_entry){
+				    .queue = TX_RING_DATA, .packet = packet });
 			}
 		}
 	}
@@ -262,9 +340,93 @@ static int prio(void)
 	return 0;
 }
 
+static void thread_conf_load(struct thread_conf *conf, int priority_offset)
+{
+	char key[32];
+	char *value;
+
+	snprintf(key, sizeof(key), "thread_%s_priority", conf->name);
+	value = freedv_eth_config_value(key, NULL, NULL);
+	if (value)
+		conf->priority = atoi(value);
+	else
+		conf->priority = sched_get_priority_max(SCHED_FIFO) - priority_offset;
+
+	snprintf(key, sizeof(key), "thread_%s_cpu", conf->name);
+	conf->cpu = atoi(freedv_eth_config_value(key, NULL, "-1"));
+}
+
+/* Set the priority and affinity of the calling thread */
+static void thread_prio(struct thread_conf *conf)
+{
+	struct sched_param param;
+	int r;
+
+	param.sched_priority = conf->priority;
+	r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (r) {
+		printf("%s thread: pthread_setschedparam() failed: %s\n",
+		    conf->name, strerror(r));
+	}
+	if (conf->cpu >= 0) {
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(conf->cpu, &cpus);
+		r = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (r) {
+			printf("%s thread: pthread_setaffinity_np() failed: %s\n",
+			    conf->name, strerror(r));
+		}
+	}
+	printf("%s thread: priority %d, cpu %d\n", conf->name, conf->priority, conf->cpu);
+}
+
+/* Network ingress: frames from the interface are transcoded here and
+   passed to the tx thread through ring_net */
+static void *thread_net(void *arg)
+{
+	struct pollfd fds[1];
+
+	thread_prio(&thread_conf_net);
+
+	fds[0].fd = interface_fd(iface);
+	fds[0].events = POLLIN;
+
+	do {
+		if (poll(fds, 1, -1) < 0)
+			continue;
+
+		if (fds[0].revents & POLLIN) {
+			interface_tx_raw_burst(iface, cb_int_tx, INTERFACE_BURST_MAX);
+		}
+	} while (1);
+
+	return NULL;
+}
+
+/* Sound input and demodulation, the only writer to the interface */
+static void *thread_rx(void *arg)
+{
+	int nfds = sound_poll_count_rx();
+	struct pollfd fds[nfds];
+
+	thread_prio(&thread_conf_rx);
 
+	sound_poll_fill_rx(fds, nfds);
 
+	do {
+		if (poll(fds, nfds, -1) < 0)
+			continue;
 
+		if (sound_poll_in_rx(fds, nfds)) {
+			sound_rx();
+			interface_rx_flush(iface);
+		}
+	} while (1);
+
+	return NULL;
+}
 
 void read_nmea(int fd_nmea)
 {
@@ -296,7 +458,6 @@ static void usage(void)
 
 int main(int argc, char **argv)
 {
-	int fd_int;
 	int fd_nmea = -1;
 	int fd_modem = -1;
 	struct pollfd *fds;
@@ -307,6 +468,9 @@ int main(int argc, char **argv)
 	int poll_int = 0;
 	int poll_nmea = 0;
 	int poll_modem = 0;
+	int poll_ring_rx = 0;
+	int poll_workers = 0;
+	int workers_fdc = 0;
 	uint16_t type;
 	int nr_samples = 0;
 	int freedv_mode = -1;
@@ -316,6 +480,9 @@ int main(int argc, char **argv)
 	bool analog_in = false;
 
 	bool need_sound = false;
+	bool threaded_rx = false;
+	struct freedv *freedv_rx;
+	pthread_t thread;
 
 	if (argc < 2) {
 		usage();
@@ -330,6 +497,10 @@ int main(int argc, char **argv)
 	char *nmeadev = freedv_eth_config_value("nmea_device", NULL, NULL);
 	char *sounddev = freedv_eth_config_value("sound_device", NULL, "default");
 	int sound_rate = atoi(freedv_eth_config_value("sound_rate", NULL, "48000"));
+	bool sound_mmap = atoi(freedv_eth_config_value("sound_mmap", NULL, "0"));
+	int sound_buffer_msec = atoi(freedv_eth_config_value("sound_buffer", NULL, "200"));
+	int sound_period_msec = atoi(freedv_eth_config_value("sound_period", NULL, "20"));
+	int sound_tune_msec = atoi(freedv_eth_config_value("sound_tune", NULL, "0"));
 	char *netname = freedv_eth_config_value("network_device", NULL, "freedv");
 	char *call = freedv_eth_config_value("callsign", NULL, "pirate");
 	tx_delay_msec = atoi(freedv_eth_config_value("tx_delay", NULL, "100"));
@@ -355,6 +526,10 @@ int main(int argc, char **argv)
 	baseband_in = atoi(freedv_eth_config_value("baseband_in", NULL, "0"));
 	baseband_in_tx = atoi(freedv_eth_config_value("baseband_in_tx", NULL, "0"));
 	char *modem_file = freedv_eth_config_value("external_modem", NULL, NULL);
+	int packet_prealloc = atoi(freedv_eth_config_value("packet_prealloc", NULL, "256"));
+	bool threads = atoi(freedv_eth_config_value("threads", NULL, "0"));
+	int thread_ring_size = atoi(freedv_eth_config_value("thread_ring_size", NULL, "256"));
+	int transcode_workers = atoi(freedv_eth_config_value("transcode_workers", NULL, "0"));
 
 	if (!modem_file) {
 		need_sound = true;
@@ -520,6 +695,16 @@ int main(int argc, char **argv)
 	freedv_set_callback_data(freedv, freedv_eth_rx_cb_datarx, freedv_eth_tx_cb_datatx, NULL);
 	freedv_set_data_header(freedv, mac);
 
+	/* The modem state is not shared between threads, rx gets its own */
+	threaded_rx = threads && need_sound && !modem_file;
+	freedv_rx = freedv;
+	if (threaded_rx && (rx_mode == RX_MODE_FREEDV || rx_mode == RX_MODE_MIXED)) {
+		freedv_rx = freedv_open(freedv_mode);
+		freedv_set_callback_txt(freedv_rx, freedv_eth_rx_vc_callback, freedv_eth_tx_vc_callback, NULL);
+		freedv_set_callback_data(freedv_rx, freedv_eth_rx_cb_datarx, freedv_eth_tx_cb_datatx, NULL);
+		freedv_set_data_header(freedv_rx, mac);
+	}
+
 	if (tx_mode == TX_MODE_FREEDV) {
 		tx_codecmode = eth_ar_eth_p_codecmode(type);
 	} else {
@@ -530,15 +715,37 @@ int main(int argc, char **argv)
 	if (rx_mode == RX_MODE_MIXED)
 		force_channels_in = 2;
 
-	fd_int = interface_init(netname, mac, true, 0);
+	iface = interface_init(netname, mac, true, 0);
+	if (iface) {
+		/* Only wake up for frames we actually handle, in the data
+		   modes that is any frame. */
+		if (freedv_hasdata) {
+			interface_filter_set(iface, NULL);
+		} else {
+			struct interface_filter filter = { 0 };
+			interface_filter_add_voice(&filter);
+			interface_filter_add_type(&filter, ETH_P_AR_CONTROL, ETH_P_AR_CONTROL);
+			interface_filter_add_type(&filter, ETH_P_FPRS, ETH_P_FPRS);
+			interface_filter_set(iface, &filter);
+		}
+
+		interface_rx_queue(iface, true);
+	}
 	if (need_sound) {
+		sound_mmap_set(sound_mmap);
+		sound_latency_set(sound_buffer_msec, sound_period_msec, sound_tune_msec);
 		sound_rate = sound_init(sounddev, cb_sound_in, sound_rate, force_channels_in, 2);
 		if (sound_rate < 0)
 			return -1;
 	}
 	
 	tc = freedv_eth_transcode_init(sound_rate);
-	tc_iface = freedv_eth_transcode_init(sound_rate);
+	/* With threads the net thread uses tc, and rx runs in the rx
+	   thread or (with a modem) the main thread */
+	if (threads)
+		tc_rx = freedv_eth_transcode_init(sound_rate);
+	else
+		tc_rx = tc;
 	
 	if (need_sound) {
 		if (tx_mode == TX_MODE_FREEDV) {
@@ -553,9 +760,9 @@ int main(int argc, char **argv)
 		sound_set_nr(nr_samples);
 	}
 	
-	freedv_eth_rx_init(freedv, mac, sound_rate);
+	freedv_eth_rx_init(freedv_rx, mac, sound_rate, iface);
 	if (analog_in)
-		freedv_eth_rxa_init(sound_rate, mac, nr_samples);
+		freedv_eth_rxa_init(sound_rate, mac, nr_samples, iface);
 
 	if (baseband_in)
 		freedv_eth_bb_in_init(sound_rate, mac, nr_samples);
@@ -573,6 +780,30 @@ int main(int argc, char **argv)
 		    sound_rate, 
 		    tx_tail_msec);
 	}
+	if (tx_mode != TX_MODE_NONE) {
+		/* Jitter buffer, voter and bounds all work in the unit that is
+		   queued: codec2 frames for the FreeDV tx, native samples when
+		   the analog tx takes the voice. Baseband is always native
+		   samples. */
+		size_t frame_bytes;
+		int frame_usec;
+		int jitter_min_msec = atoi(freedv_eth_config_value("tx_jitter_min", NULL, "0"));
+		int jitter_max_msec = atoi(freedv_eth_config_value("tx_jitter_max", NULL, "200"));
+
+		if (tx_codecmode == CODEC_MODE_NATIVE16) {
+			frame_usec = 1000000LL * FREEDV_ALAW_NR_SAMPLES / FREEDV_ALAW_RATE;
+			frame_bytes = FREEDV_ALAW_NR_SAMPLES * sound_rate / FREEDV_ALAW_RATE * sizeof(int16_t);
+		} else {
+			frame_usec = freedv_eth_tx_frame_usec();
+			frame_bytes = freedv_eth_tx_frame_bytes();
+		}
+		/* Only the FreeDV tx plays voice frame by frame */
+		if (tx_mode != TX_MODE_ANALOG)
+			queue_voice_jitter_init(frame_bytes, frame_usec,
+			    jitter_min_msec, jitter_max_msec);
+		queue_voice_voter_init(frame_bytes);
+		queue_limits_init(frame_bytes * 1000000LL / frame_usec, sound_rate * sizeof(int16_t));
+	}
 	
 	if (nmeadev) {
 		fd_nmea = open(nmeadev, O_RDONLY);
@@ -590,29 +821,86 @@ int main(int argc, char **argv)
 	}
 
 
+	/* Before prio(), so mlockall() covers the packets */
+	if (tx_packet_prealloc(packet_prealloc))
+		printf("Could not preallocate %d packets\n", packet_prealloc);
+
+	if (threads) {
+		ring_net = tx_ring_create(thread_ring_size);
+		if (threaded_rx)
+			ring_rx = tx_ring_create(thread_ring_size);
+		if (!ring_net || (threaded_rx && !ring_rx)) {
+			printf("Could not create thread rings\n");
+			return -1;
+		}
+	}
+
+	if (transcode_workers < 0)
+		transcode_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (transcode_workers > 0 && tx_mode != TX_MODE_NONE) {
+		struct thread_conf thread_conf_transcode = { "transcode" };
+
+		thread_conf_load(&thread_conf_transcode, 3);
+		workers = transcode_workers_create(transcode_workers, sound_rate,
+		    thread_ring_size, thread_conf_transcode.priority,
+		    tx_codecmode, baseband_out);
+		if (!workers)
+			return -1;
+		workers_fdc = transcode_workers_poll_count(workers);
+	}
+
 	prio();
 	
-	if (fd_int < 0) {
+	if (!iface) {
 		printf("Could not create interface\n");
 		return -1;
 	}
 
+	if (threads) {
+		thread_conf_load(&thread_conf_tx, 0);
+		thread_conf_load(&thread_conf_rx, 1);
+		thread_conf_load(&thread_conf_net, 2);
+
+		thread_prio(&thread_conf_tx);
+		if (pthread_create(&thread, NULL, thread_net, NULL)) {
+			printf("Could not create net thread\n");
+			return -1;
+		}
+		if (threaded_rx && pthread_create(&thread, NULL, thread_rx, NULL)) {
+			printf("Could not create rx thread\n");
+			return -1;
+		}
+	}
+
 	if (need_sound) {
 		sound_fdc_tx = sound_poll_count_tx();
-		sound_fdc_rx = sound_poll_count_rx();
+		if (!threaded_rx)
+			sound_fdc_rx = sound_poll_count_rx();
 	}
-	nfds = sound_fdc_tx + sound_fdc_rx + 1 + (nmea ? 1 : 0) + (modem_file ? 1 : 0);
+	nfds = sound_fdc_tx + sound_fdc_rx + 1 + (ring_rx ? 1 : 0) + workers_fdc + (nmea ? 1 : 0) + (modem_file ? 1 : 0);
 	fds = calloc(sizeof(struct pollfd), nfds);
 	
 	poll_i = 0;
 	if (need_sound) {
 		sound_poll_fill_tx(fds, sound_fdc_tx);
-		sound_poll_fill_rx(fds + sound_fdc_tx, sound_fdc_rx);
+		if (sound_fdc_rx)
+			sound_poll_fill_rx(fds + sound_fdc_tx, sound_fdc_rx);
 		poll_i += sound_fdc_tx + sound_fdc_rx;
 	}
+	/* Either the interface itself or the ring filled by the net thread */
 	poll_int = poll_i++;
-	fds[poll_int].fd = fd_int;
+	fds[poll_int].fd = ring_net ? tx_ring_fd(ring_net) : interface_fd(iface);
 	fds[poll_int].events = POLLIN;
+	if (ring_rx) {
+		poll_ring_rx = poll_i++;
+		fds[poll_ring_rx].fd = tx_ring_fd(ring_rx);
+		fds[poll_ring_rx].events = POLLIN;
+	}
+	if (workers) {
+		poll_workers = poll_i;
+		transcode_workers_poll_fill(workers, fds + poll_workers, workers_fdc);
+		poll_i += workers_fdc;
+	}
 	if (nmea) {
 		poll_nmea = poll_i++;
 		fds[poll_nmea].fd = fd_nmea;
@@ -623,12 +911,32 @@ int main(int argc, char **argv)
 		fds[poll_modem].fd = fd_modem;
 	}
 	
+	signal(SIGUSR1, stats_signal);
+
 	do {
 		if (modem_file) {
 			freedv_eth_modem_poll(&fds[poll_modem].events);
 		}
 		
-		poll(fds, nfds, -1);
+		if (poll(fds, nfds, -1) < 0) {
+			/* Interrupted, e.g. by SIGUSR1: nothing is ready, but
+			   the stats are still dumped below */
+			int i;
+
+			for (i = 0; i < nfds; i++)
+				fds[i].revents = 0;
+		}
+
+		/* Packets from the other threads go in before tx needs them */
+		if (ring_net && fds[poll_int].revents & POLLIN) {
+			tx_ring_drain(ring_net);
+		}
+		if (ring_rx && fds[poll_ring_rx].revents & POLLIN) {
+			tx_ring_drain(ring_rx);
+		}
+		if (workers && transcode_workers_poll_in(workers, fds + poll_workers, workers_fdc)) {
+			transcode_workers_drain(workers);
+		}
 
 		bool do_tx_state_machine;
 		
@@ -657,10 +965,10 @@ int main(int argc, char **argv)
 			else
 				freedv_eth_tx_none(nr_samples);
 		}
-		if (fds[poll_int].revents & POLLIN) {
-			interface_tx_raw(cb_int_tx);
+		if (!ring_net && fds[poll_int].revents & POLLIN) {
+			interface_tx_raw_burst(iface, cb_int_tx, INTERFACE_BURST_MAX);
 		}
-		if (need_sound && sound_poll_in_rx(fds + sound_fdc_tx, sound_fdc_rx)) {
+		if (sound_fdc_rx && sound_poll_in_rx(fds + sound_fdc_tx, sound_fdc_rx)) {
 			sound_rx();
 		}
 		if (nmea && fds[poll_nmea].revents & POLLIN) {
@@ -674,6 +982,28 @@ int main(int argc, char **argv)
 				freedv_eth_modem_tx(fd_modem);
 			}
 		}
+		/* Everything produced in this period goes out at once,
+		   the rx thread flushes its own output */
+		if (!threaded_rx)
+			interface_rx_flush(iface);
+
+		if (stats_dump) {
+			stats_dump = 0;
+			interface_stats_print(iface, netname);
+			tx_packet_stats_print();
+			queue_stats_print();
+			freedv_eth_transcode_stats_print(tc, "net");
+			if (tc_rx != tc)
+				freedv_eth_transcode_stats_print(tc_rx, "rx");
+			if (ring_net)
+				tx_ring_stats_print(ring_net, "net");
+			if (ring_rx)
+				tx_ring_stats_print(ring_rx, "rx");
+			if (workers)
+				transcode_workers_stats_print(workers);
+			if (need_sound)
+				sound_latency_print();
+		}
 	} while (1);
 	
 	
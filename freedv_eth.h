@@ -20,6 +20,7 @@
 #define _INCLUDE_FREEDV_ETH_H_
 
 #include "nmea.h"
+#include "interface.h"
 
 #include <codec2/codec2.h>
 #include <codec2/freedv_api.h>
@@ -28,6 +29,7 @@
 #include <arpa/inet.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <poll.h>
 
 static inline uint16_t freedv_eth_mode2type(int mode)
 {
@@ -72,16 +74,31 @@ static inline uint16_t freedv_eth_mode2type(int mode)
 	return type;
 }
 
+/* Packets come from slabs in a few size classes, the largest is the
+   maximum packet size. */
 #define TX_PACKET_LEN_MAX 4096
 struct tx_packet {
 	uint8_t from[6];
-	uint8_t data[TX_PACKET_LEN_MAX];
 	size_t len;
 	size_t off;
 	bool local_rx;
+	/* Voter bookkeeping */
+	double level_dbm;
+	uint64_t arrival;
 	
 	struct tx_packet *next;
 	struct tx_packet *prev;
+
+	/* Allocator bookkeeping */
+	size_t size;
+	uint32_t pool_class;
+	uint32_t pool_index;
+	_Atomic uint32_t pool_next;
+
+	/* Room to put a header in front of data, see interface_rx_headroom().
+	   Aligned so data is suitably aligned for samples. */
+	uint8_t head[INTERFACE_HEADROOM] __attribute__((__aligned__(16)));
+	uint8_t data[];
 };
 
 static inline size_t tx_packet_max(void)
@@ -89,39 +106,145 @@ static inline size_t tx_packet_max(void)
 	return TX_PACKET_LEN_MAX;
 }
 
-struct tx_packet *tx_packet_alloc(void);
+/* Returns a packet with room for at least size bytes, or NULL */
+struct tx_packet *tx_packet_alloc(size_t size);
 void tx_packet_free(struct tx_packet *packet);
+/* Make room for size bytes, keeping the contents. The packet may move,
+   the old pointer is no longer valid. Returns NULL (and keeps the old
+   packet) if it can not grow. */
+struct tx_packet *tx_packet_grow(struct tx_packet *packet, size_t size);
+/* Fill the free lists of all size classes, before locking memory.
+   Afterwards allocation only takes from the lists and fails when a
+   class is empty. */
+int tx_packet_prealloc(int nr);
+void tx_packet_stats_print(void);
 
 struct tx_packet *dequeue_voice(void);
 struct tx_packet *peek_voice(void);
 int enqueue_voice(struct tx_packet *packet, uint8_t transmission, double level_dbm);
 bool queue_voice_filled(size_t min_len);
+/* Copy up to len bytes from the front of the queue, consuming them */
+size_t dequeue_voice_bytes(uint8_t *data, size_t len);
+size_t queue_voice_bytes(void);
+size_t queue_voice_packets(void);
+/* Jitter buffer on top of the voice queue, for the frame based tx path */
+void queue_voice_jitter_init(size_t frame_bytes, int frame_usec, int min_msec, int max_msec);
+/* True when a frame should be sent, which may be a concealed one */
+bool queue_voice_ready(void);
+size_t dequeue_voice_frame(uint8_t *data);
+/* Vote between streams of the same audio from several receivers, in
+   frames of frame_bytes */
+void queue_voice_voter_init(size_t frame_bytes);
 void queue_voice_end(uint8_t transmission);
 
-struct tx_packet *dequeue_baseband(void);
-struct tx_packet *peek_baseband(void);
+/* Copies the samples into the baseband ring and frees the packet */
 void enqueue_baseband(struct tx_packet *packet);
+/* Take exactly nr samples, padded with silence if fewer are queued.
+   Returns NULL if nothing is queued, the view is valid until the next
+   baseband call. */
+int16_t *dequeue_baseband_exact(size_t nr);
 bool queue_baseband_filled(void);
-void ensure_baseband(size_t nr);
+size_t queue_baseband_bytes(void);
 
 struct tx_packet *dequeue_data(void);
 struct tx_packet *peek_data(void);
 void enqueue_data(struct tx_packet *packet);
 bool queue_data_filled(void);
+size_t queue_data_bytes(void);
+size_t queue_data_packets(void);
 
 struct tx_packet *dequeue_control(void);
 struct tx_packet *peek_control(void);
 void enqueue_control(struct tx_packet *packet);
 bool queue_control_filled(void);
+size_t queue_control_bytes(void);
+size_t queue_control_packets(void);
+void queue_stats_print(void);
+
+enum queue_drop {
+	QUEUE_DROP_OLDEST,
+	QUEUE_DROP_NEWEST,
+};
+
+/* Read the queue limits from the config, voice and baseband are limited
+   in msec and converted to bytes with the given rates. */
+void queue_limits_init(size_t voice_bytes_per_sec, size_t baseband_bytes_per_sec);
+
+/* Bounded ring handing packets from the network and rx threads to the
+   tx queues, one producer and one consumer per ring */
+enum tx_ring_queue {
+	TX_RING_VOICE,
+	TX_RING_VOICE_END,
+	TX_RING_BASEBAND,
+	TX_RING_DATA,
+	TX_RING_CONTROL,
+};
+
+struct tx_ring_entry {
+	enum tx_ring_queue queue;
+	struct tx_packet *packet;
+	/* Voice only: queued as baseband if the voice packet is accepted */
+	struct tx_packet *baseband;
+	uint8_t transmission;
+	double level_dbm;
+	/* Voice only: codec of packet, for the transcode workers */
+	uint16_t eth_type;
+};
+
+struct tx_ring;
+
+struct tx_ring *tx_ring_create(int nr);
+/* eventfd, readable when entries were put in the ring */
+int tx_ring_fd(struct tx_ring *ring);
+/* The packets are freed if the ring is full */
+int tx_ring_put(struct tx_ring *ring, struct tx_ring_entry *entry);
+/* Move all entries to the tx queues, returns the number moved */
+int tx_ring_drain(struct tx_ring *ring);
+/* Pass all entries to cb, returns the number passed */
+int tx_ring_consume(struct tx_ring *ring, void (*cb)(struct tx_ring_entry *entry, void *arg), void *arg);
+/* Queue an entry directly, without a ring */
+void tx_ring_entry_enqueue(struct tx_ring_entry *entry);
+void tx_ring_stats_print(struct tx_ring *ring, char *name);
 
 void freedv_eth_voice_rx(uint8_t to[6], uint8_t from[6], uint16_t eth_type, uint8_t *data, size_t len, bool local_rx, uint8_t transmission, double level);
+void freedv_eth_voice_end(uint8_t transmission);
 
 bool freedv_eth_cdc(void);
 
 struct freedv_eth_transcode;
 
 struct freedv_eth_transcode * freedv_eth_transcode_init(int native_rate);
-int freedv_eth_transcode(struct freedv_eth_transcode *tc, struct tx_packet *packet, int to_codecmode, uint16_t from_type);
+
+struct freedv_eth_transcode_target {
+	int codecmode;
+	/* Result, a new packet or NULL if it could not be allocated */
+	struct tx_packet *packet;
+};
+
+/* Transcode data to several codecs at once. The data is decoded once and
+   resampled once for each distinct rate, then each target is encoded.
+   Codec and resampler state is kept per sender (from) and type. */
+int freedv_eth_transcode_fanout(struct freedv_eth_transcode *tc,
+    struct freedv_eth_transcode_target *target, int nr,
+    uint8_t from[6], uint16_t from_type, uint8_t *data, size_t len);
+void freedv_eth_transcode_stats_print(struct freedv_eth_transcode *tc, char *name);
+
+/* Threads transcoding network voice in parallel. Streams are spread
+   over the workers by sender, so the packets of a stream stay in order.
+   Results come back through a ring per worker. */
+struct transcode_workers;
+
+struct transcode_workers *transcode_workers_create(int nr, int native_rate,
+    int ring_size, int priority, int codecmode, bool baseband);
+/* Hand a voice packet, still in its own codec (entry->eth_type), to the
+   worker for its sender. The packet is freed if the worker is behind. */
+int transcode_workers_put(struct transcode_workers *w, struct tx_ring_entry *entry);
+int transcode_workers_poll_count(struct transcode_workers *w);
+int transcode_workers_poll_fill(struct transcode_workers *w, struct pollfd *fds, int count);
+bool transcode_workers_poll_in(struct transcode_workers *w, struct pollfd *fds, int count);
+/* Move the transcoded packets to the tx queues */
+int transcode_workers_drain(struct transcode_workers *w);
+void transcode_workers_stats_print(struct transcode_workers *w);
 
 int freedv_eth_tx_init(struct freedv *init_freedv, uint8_t init_mac[6], 
     struct nmea_state *init_nmea, bool init_fullduplex,
@@ -129,6 +252,9 @@ int freedv_eth_tx_init(struct freedv *init_freedv, uint8_t init_mac[6],
     int tx_tail_msec, int tx_delay_msec,
     int tx_channel,
     bool modem);
+/* Size and duration of the codec2 frames the tx sends per period */
+size_t freedv_eth_tx_frame_bytes(void);
+int freedv_eth_tx_frame_usec(void);
 char freedv_eth_tx_vc_callback(void *arg);
 void freedv_eth_tx_state_machine(void);
 bool freedv_eth_tx_ptt(void);
@@ -143,7 +269,7 @@ void freedv_eth_txa_state_machine(void);
 bool freedv_eth_txa_ptt(void);
 
 bool freedv_eth_rxa_cdc(void);
-int freedv_eth_rxa_init(int hw_rate, uint8_t mac_init[6], int hw_nr);
+int freedv_eth_rxa_init(int hw_rate, uint8_t mac_init[6], int hw_nr, struct interface *iface_init);
 void freedv_eth_rxa(int16_t *samples, int nr);
 
 int freedv_eth_bb_in_init(int hw_rate, uint8_t mac_init[6], int nr_hw);
@@ -58,7 +58,7 @@ void freedv_eth_baseband_in(int16_t *samples, int nr)
 
 	bool new_cdc = io_hl_aux2_get();
 	if (!new_cdc && cdc) {
-		queue_voice_end(transmission);
+		freedv_eth_voice_end(transmission);
 		transmission++;
 	}
 	cdc = new_cdc;
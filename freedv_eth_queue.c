@@ -17,27 +17,187 @@
  */
 
 #include "freedv_eth.h"
+#include "freedv_eth_config.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <stdatomic.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 
-static _Atomic(struct tx_packet *) tx_packet_pool = NULL;
+/* Packet allocator.
+   Each size class has slabs of packets that are never given back. Free
+   packets are kept on a lock free stack. The head of the stack holds
+   the index (+1) of the top packet and a tag that changes with every
+   update, so a pop racing with a pop and push of the same packet (ABA)
+   fails its compare and swap.
+   Packets that do not fit in the slab index of a class are malloc()ed.
+   Once tx_packet_prealloc() has filled the pool nothing is allocated
+   anymore, so the real-time threads never call malloc(). An empty
+   class then fails the allocation and counts it.
+ */
+#define TX_PACKET_CLASSES	3
+#define TX_PACKET_CLASS_MAX	4096	/* packets per class */
+#define TX_PACKET_SLAB		16	/* packets added at once when empty */
+#define TX_PACKET_UNPOOLED	UINT32_MAX
+
+struct tx_packet_class {
+	size_t size;
+
+	_Atomic uint64_t free;
+	_Atomic uint32_t nr;
+
+	/* Statistics */
+	_Atomic uint32_t used;
+	_Atomic uint32_t used_max;
+	_Atomic uint32_t unpooled;
+	_Atomic uint32_t failed;
+
+	struct tx_packet *packets[TX_PACKET_CLASS_MAX];
+};
+
+static struct tx_packet_class tx_packet_classes[TX_PACKET_CLASSES] = {
+	{ .size = 64 },
+	{ .size = 512 },
+	{ .size = TX_PACKET_LEN_MAX },
+};
+
+static atomic_bool tx_packet_sealed;
 
 static uint8_t voice_transmission = 0;
 static double voice_level = -INFINITY;
 
-struct tx_packet *tx_packet_alloc(void)
+static size_t tx_packet_stride(struct tx_packet_class *class)
+{
+	size_t stride = sizeof(struct tx_packet) + class->size;
+
+	return (stride + 15) & ~(size_t)15;
+}
+
+static void tx_packet_push(struct tx_packet_class *class, struct tx_packet *packet)
+{
+	uint64_t head = atomic_load(&class->free);
+	uint64_t new;
+
+	do {
+		atomic_store_explicit(&packet->pool_next, (uint32_t)head, memory_order_relaxed);
+		new = ((head >> 32) + 1) << 32 | (packet->pool_index + 1);
+	} while (!atomic_compare_exchange_weak(&class->free, &head, new));
+}
+
+static struct tx_packet *tx_packet_pop(struct tx_packet_class *class)
 {
+	uint64_t head = atomic_load(&class->free);
+	uint64_t new;
 	struct tx_packet *packet;
-	
+
 	do {
-		if (tx_packet_pool) {
-			packet = tx_packet_pool;
-		} else {
-			return malloc(sizeof(struct tx_packet));
-		}
-	} while (!atomic_compare_exchange_weak(&tx_packet_pool, &packet, packet->next));
+		uint32_t index = (uint32_t)head;
+
+		if (!index)
+			return NULL;
+		packet = class->packets[index - 1];
+		new = ((head >> 32) + 1) << 32 |
+		    atomic_load_explicit(&packet->pool_next, memory_order_relaxed);
+	} while (!atomic_compare_exchange_weak(&class->free, &head, new));
+
+	return packet;
+}
+
+/* Add up to nr packets to a class, returns the number added */
+static int tx_packet_slab(struct tx_packet_class *class, int nr)
+{
+	uint32_t first = atomic_load(&class->nr);
+	size_t stride = tx_packet_stride(class);
+	uint8_t *slab;
+	int i;
+
+	/* Reserve room in the index */
+	do {
+		if (first + nr > TX_PACKET_CLASS_MAX)
+			nr = TX_PACKET_CLASS_MAX - first;
+		if (nr <= 0)
+			return 0;
+	} while (!atomic_compare_exchange_weak(&class->nr, &first, first + nr));
+
+	/* Touch all of it, so it is resident before mlockall() */
+	slab = aligned_alloc(16, stride * nr);
+	if (!slab) {
+		/* Give the index back, unless another slab came after it */
+		uint32_t end = first + nr;
+
+		atomic_compare_exchange_strong(&class->nr, &end, first);
+		return 0;
+	}
+	memset(slab, 0, stride * nr);
+
+	for (i = 0; i < nr; i++) {
+		struct tx_packet *packet = (void*)(slab + stride * i);
+
+		packet->size = class->size;
+		packet->pool_class = class - tx_packet_classes;
+		packet->pool_index = first + i;
+		class->packets[first + i] = packet;
+		tx_packet_push(class, packet);
+	}
+
+	return nr;
+}
+
+int tx_packet_prealloc(int nr)
+{
+	int i;
+
+	for (i = 0; i < TX_PACKET_CLASSES; i++) {
+		struct tx_packet_class *class = &tx_packet_classes[i];
+		int have = atomic_load(&class->nr);
+
+		if (nr > have && tx_packet_slab(class, nr - have) < nr - have)
+			return -1;
+	}
+	if (nr > 0)
+		atomic_store(&tx_packet_sealed, true);
+
+	return 0;
+}
+
+struct tx_packet *tx_packet_alloc(size_t size)
+{
+	struct tx_packet_class *class;
+	struct tx_packet *packet;
+	uint32_t used, used_max;
+	int i;
+
+	for (i = 0; i < TX_PACKET_CLASSES; i++) {
+		if (size <= tx_packet_classes[i].size)
+			break;
+	}
+	if (i == TX_PACKET_CLASSES)
+		return NULL;
+	class = &tx_packet_classes[i];
+
+	packet = tx_packet_pop(class);
+	if (!packet && atomic_load_explicit(&tx_packet_sealed, memory_order_relaxed)) {
+		atomic_fetch_add(&class->failed, 1);
+		return NULL;
+	}
+	if (!packet && tx_packet_slab(class, TX_PACKET_SLAB))
+		packet = tx_packet_pop(class);
+	if (!packet) {
+		packet = aligned_alloc(16, tx_packet_stride(class));
+		if (!packet)
+			return NULL;
+		packet->size = class->size;
+		packet->pool_class = i;
+		packet->pool_index = TX_PACKET_UNPOOLED;
+		atomic_fetch_add(&class->unpooled, 1);
+	}
+
+	used = atomic_fetch_add(&class->used, 1) + 1;
+	used_max = atomic_load(&class->used_max);
+	while (used > used_max &&
+	    !atomic_compare_exchange_weak(&class->used_max, &used_max, used));
 
 	packet->len = 0;
 	packet->off = 0;
@@ -48,37 +208,605 @@ struct tx_packet *tx_packet_alloc(void)
 
 void tx_packet_free(struct tx_packet *packet)
 {
-	struct tx_packet *next;
+	struct tx_packet_class *class = &tx_packet_classes[packet->pool_class];
 
-	do {
-		next = tx_packet_pool;
-		packet->next = next;
-	} while (!atomic_compare_exchange_weak(&tx_packet_pool, &next, packet));
+	atomic_fetch_sub(&class->used, 1);
+
+	if (packet->pool_index == TX_PACKET_UNPOOLED)
+		free(packet);
+	else
+		tx_packet_push(class, packet);
 }
 
-static struct tx_packet *queue_voice = NULL;
-static struct tx_packet **queue_voice_tail = &queue_voice;
+struct tx_packet *tx_packet_grow(struct tx_packet *packet, size_t size)
+{
+	struct tx_packet *new;
 
-struct tx_packet *dequeue_voice(void)
+	if (size <= packet->size)
+		return packet;
+
+	new = tx_packet_alloc(size);
+	if (!new)
+		return NULL;
+
+	memcpy(new->from, packet->from, sizeof(new->from));
+	memcpy(new->data, packet->data, packet->len);
+	new->len = packet->len;
+	new->off = packet->off;
+	new->local_rx = packet->local_rx;
+	new->next = packet->next;
+	new->prev = packet->prev;
+	tx_packet_free(packet);
+
+	return new;
+}
+
+void tx_packet_stats_print(void)
+{
+	int i;
+
+	printf("Packet pool:\n");
+	for (i = 0; i < TX_PACKET_CLASSES; i++) {
+		struct tx_packet_class *class = &tx_packet_classes[i];
+
+		printf("\t%4zd bytes: %u allocated, %u in use, %u max in use, %u outside pool, %u failed\n",
+		    class->size, atomic_load(&class->nr), atomic_load(&class->used),
+		    atomic_load(&class->used_max), atomic_load(&class->unpooled),
+		    atomic_load(&class->failed));
+	}
+}
+
+/* A packet queue with running totals, so fill checks need no walk.
+   With max_bytes set the queue is bounded, when a packet does not fit
+   either the packet itself or the oldest packets are dropped. */
+struct queue {
+	struct tx_packet *head;
+	struct tx_packet **tail;
+	size_t bytes;
+	size_t packets;
+
+	size_t max_bytes;
+	enum queue_drop drop;
+	uint64_t dropped_packets;
+	uint64_t dropped_bytes;
+};
+
+#define QUEUE_INIT(q) { .head = NULL, .tail = &(q).head }
+
+static struct queue queue_voice = QUEUE_INIT(queue_voice);
+static struct queue queue_data = QUEUE_INIT(queue_data);
+static struct queue queue_control = QUEUE_INIT(queue_control);
+
+static struct tx_packet *queue_dequeue(struct queue *q)
 {
 	struct tx_packet *packet;
 	
-	packet = queue_voice;
-	queue_voice = packet->next;
-	if (&packet->next == queue_voice_tail) {
-		queue_voice_tail = &queue_voice;
+	packet = q->head;
+	q->head = packet->next;
+	if (&packet->next == q->tail) {
+		q->tail = &q->head;
 	}
+	q->bytes -= packet->len;
+	q->packets--;
 	return packet;
 }
 
+static void queue_drop(struct queue *q, struct tx_packet *packet)
+{
+	q->dropped_packets++;
+	q->dropped_bytes += packet->len;
+	tx_packet_free(packet);
+}
+
+/* Returns false if the packet was dropped */
+static bool queue_enqueue(struct queue *q, struct tx_packet *packet)
+{
+	if (q->max_bytes) {
+		if (q->drop == QUEUE_DROP_NEWEST) {
+			if (q->bytes + packet->len > q->max_bytes) {
+				queue_drop(q, packet);
+				return false;
+			}
+		} else {
+			while (q->head && q->bytes + packet->len > q->max_bytes)
+				queue_drop(q, queue_dequeue(q));
+		}
+	}
+
+	packet->next = NULL;
+	*q->tail = packet;
+	q->tail = &packet->next;
+	q->bytes += packet->len;
+	q->packets++;
+
+	return true;
+}
+
+static bool queue_filled(struct queue *q, size_t min_len)
+{
+	return q->packets && q->bytes >= min_len;
+}
+
+/* Consume up to len bytes from the front of the queue, copying them to
+   data unless it is NULL */
+static size_t queue_read(struct queue *q, uint8_t *data, size_t len)
+{
+	size_t done = 0;
+
+	while (done < len && q->head) {
+		struct tx_packet *packet = q->head;
+		size_t copy = len - done;
+
+		if (packet->len < copy)
+			copy = packet->len;
+		if (data)
+			memcpy(data + done, packet->data, copy);
+		done += copy;
+
+		if (packet->len > copy) {
+			memmove(packet->data, packet->data + copy, packet->len - copy);
+			packet->len -= copy;
+			q->bytes -= copy;
+		} else {
+			tx_packet_free(queue_dequeue(q));
+		}
+	}
+
+	return done;
+}
+
+static void voter_run(uint64_t now);
+
+struct tx_packet *dequeue_voice(void)
+{
+	return queue_dequeue(&queue_voice);
+}
+
 struct tx_packet *peek_voice(void)
 {
-	return queue_voice;
+	voter_run(0);
+
+	return queue_voice.head;
+}
+
+/* Jitter buffer for voice.
+   Arrival times are compared with the amount of audio received so far in
+   the same stream (a sender and its transmission number), and the mean
+   deviation is kept per stream like the RTP interarrival jitter. Playing
+   only starts once the queue holds a few times that jitter, so a stream
+   with a steady arrival starts right away. Frames missing during play are
+   concealed by repeating the last frame and then sending all zero frames,
+   which decode to the lowest codec2 energy. An underrun raises the
+   stream's jitter so the next start is deeper.
+ */
+#define JITTER_STREAMS		8
+#define JITTER_FACTOR		3
+#define JITTER_REPEAT		1	/* frames repeated before muting */
+#define JITTER_FRAME_MAX	256
+#define JITTER_STREAM_IDLE	1000000	/* usec before a stream restarts */
+
+struct jitter_stream {
+	bool used;
+	uint8_t from[6];
+	uint8_t transmission;
+	uint64_t start;
+	uint64_t media;
+	uint64_t last;
+	int64_t transit;
+	double jitter;
+};
+
+static struct {
+	size_t frame_bytes;
+	uint64_t frame_usec;
+	uint64_t min_usec;
+	uint64_t max_usec;
+
+	struct jitter_stream streams[JITTER_STREAMS];
+	struct jitter_stream *stream;
+
+	bool playing;
+	int concealed;
+	uint8_t last[JITTER_FRAME_MAX];
+	bool have_last;
+
+	uint64_t underruns;
+	uint64_t concealed_total;
+} jitter;
+
+static uint64_t jitter_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void queue_voice_jitter_init(size_t frame_bytes, int frame_usec, int min_msec, int max_msec)
+{
+	memset(&jitter, 0, sizeof(jitter));
+	if (frame_bytes > JITTER_FRAME_MAX || frame_usec <= 0)
+		return;
+
+	jitter.frame_bytes = frame_bytes;
+	jitter.frame_usec = frame_usec;
+	jitter.min_usec = min_msec * 1000ULL;
+	jitter.max_usec = max_msec * 1000ULL;
+	if (jitter.max_usec < jitter.min_usec + jitter.frame_usec)
+		jitter.max_usec = jitter.min_usec + jitter.frame_usec;
+
+	printf("TX jitter buffer: %d-%d msec\n",
+	    min_msec, (int)(jitter.max_usec / 1000));
+}
+
+static struct jitter_stream *jitter_stream_get(uint8_t from[6], uint8_t transmission, uint64_t now)
+{
+	struct jitter_stream *stream, *oldest = &jitter.streams[0];
+	int i;
+
+	for (i = 0; i < JITTER_STREAMS; i++) {
+		stream = &jitter.streams[i];
+		if (stream->used && stream->transmission == transmission &&
+		    !memcmp(stream->from, from, 6))
+			return stream;
+		if (!stream->used || (oldest->used && stream->last < oldest->last))
+			oldest = stream;
+	}
+
+	/* A sender's next transmission starts with its last jitter */
+	for (i = 0; i < JITTER_STREAMS; i++) {
+		stream = &jitter.streams[i];
+		if (stream->used && !memcmp(stream->from, from, 6))
+			goto found;
+	}
+	stream = oldest;
+	memset(stream, 0, sizeof(*stream));
+	memcpy(stream->from, from, 6);
+found:
+	stream->used = true;
+	stream->transmission = transmission;
+	stream->last = 0;
+
+	return stream;
+}
+
+static void jitter_arrival(struct tx_packet *packet, uint8_t transmission)
+{
+	struct jitter_stream *stream;
+	uint64_t now;
+	int64_t transit;
+
+	if (!jitter.frame_bytes)
+		return;
+
+	now = jitter_now();
+	stream = jitter_stream_get(packet->from, transmission, now);
+	if (!stream->last || now - stream->last > JITTER_STREAM_IDLE) {
+		stream->start = now;
+		stream->media = 0;
+		stream->transit = 0;
+
+		/* A partial frame left from an earlier stream would
+		   misalign all frames of this one */
+		while (!jitter.playing && queue_voice.packets &&
+		    queue_voice.bytes < jitter.frame_bytes)
+			tx_packet_free(queue_dequeue(&queue_voice));
+	}
+
+	transit = (int64_t)(now - stream->start) - (int64_t)stream->media;
+	if (stream->media)
+		stream->jitter += (fabs((double)(transit - stream->transit)) - stream->jitter) / 16;
+	stream->transit = transit;
+	stream->media += packet->len * jitter.frame_usec / jitter.frame_bytes;
+	stream->last = now;
+
+	jitter.stream = stream;
+}
+
+static uint64_t jitter_target_usec(void)
+{
+	uint64_t target = jitter.frame_usec;
+
+	if (jitter.stream)
+		target += JITTER_FACTOR * jitter.stream->jitter;
+	if (target < jitter.min_usec)
+		target = jitter.min_usec;
+	if (target > jitter.max_usec)
+		target = jitter.max_usec;
+
+	return target;
+}
+
+bool queue_voice_ready(void)
+{
+	size_t frame = jitter.frame_bytes;
+
+	if (!frame)
+		return false;
+
+	voter_run(0);
+
+	if (!jitter.playing) {
+		size_t target = jitter_target_usec() * frame / jitter.frame_usec;
+
+		if (queue_voice.bytes < frame || queue_voice.bytes < target)
+			return false;
+		jitter.playing = true;
+		jitter.concealed = 0;
+		return true;
+	}
+
+	/* Conceal for as long as the buffer was meant to cover */
+	if (queue_voice.bytes >= frame ||
+	    jitter.concealed <= jitter_target_usec() / jitter.frame_usec)
+		return true;
+
+	/* The stream is gone, start buffering again */
+	jitter.playing = false;
+	return false;
+}
+
+size_t dequeue_voice_frame(uint8_t *data)
+{
+	size_t frame = jitter.frame_bytes;
+
+	if (queue_voice.bytes >= frame) {
+		dequeue_voice_bytes(data, frame);
+		memcpy(jitter.last, data, frame);
+		jitter.have_last = true;
+		jitter.concealed = 0;
+		return frame;
+	}
+
+	/* Underrun, the next start of this stream needs more depth */
+	if (!jitter.concealed) {
+		jitter.underruns++;
+		if (jitter.stream)
+			jitter.stream->jitter += (double)jitter.frame_usec / JITTER_FACTOR;
+	}
+	if (jitter.concealed < JITTER_REPEAT && jitter.have_last)
+		memcpy(data, jitter.last, frame);
+	else
+		memset(data, 0, frame);
+	jitter.concealed++;
+	jitter.concealed_total++;
+
+	return frame;
+}
+
+/* Voter for several receive sites carrying the same audio.
+   Each site's stream (a sender and its transmission number) is queued on
+   its own, with its data placed on a common timeline. The timeline is
+   played out one frame at a time from the stream with the best level,
+   once every stream that should have the frame has it or the alignment
+   window has passed. Streams starting within the window of the first one
+   start at the same position, and the first frame waits for the window.
+   A stream starting later is aligned with the newest data already
+   received from the others. Data arriving for a frame that was already
+   played out is dropped. Switching to another stream needs
+   it to be better by the hysteresis.
+ */
+#define VOTER_STREAMS		8
+#define VOTER_STREAM_IDLE	1000000	/* usec before a stream is released */
+
+struct voter_stream {
+	bool used;
+	uint8_t from[6];
+	uint8_t transmission;
+	uint64_t last;
+	/* Timeline position of the first byte in the queue */
+	uint64_t start;
+	struct queue queue;
+};
+
+static struct {
+	size_t frame_bytes;
+	uint64_t window_usec;
+	double hysteresis;
+
+	struct voter_stream streams[VOTER_STREAMS];
+	struct voter_stream *selected;
+	/* Timeline position of the next frame to play out */
+	uint64_t out;
+	/* Position and time at which the current transmission started */
+	uint64_t event_start;
+	uint64_t event_time;
+
+	uint64_t frames;
+	uint64_t switches;
+	uint64_t late;
+} voter;
+
+void queue_voice_voter_init(size_t frame_bytes)
+{
+	int window_msec = atoi(freedv_eth_config_value("tx_voter_window", NULL, "0"));
+	double hysteresis = atof(freedv_eth_config_value("tx_voter_hysteresis", NULL, "3.0"));
+	int i;
+
+	for (i = 0; i < VOTER_STREAMS; i++)
+		queue_read(&voter.streams[i].queue, NULL, voter.streams[i].queue.bytes);
+	memset(&voter, 0, sizeof(voter));
+	for (i = 0; i < VOTER_STREAMS; i++)
+		voter.streams[i].queue.tail = &voter.streams[i].queue.head;
+
+	if (window_msec <= 0 || !frame_bytes) {
+		printf("TX voter: off\n");
+		return;
+	}
+	voter.frame_bytes = frame_bytes;
+	voter.window_usec = window_msec * 1000ULL;
+	voter.hysteresis = hysteresis;
+
+	printf("TX voter: window %d msec, hysteresis %.1f dB\n", window_msec, hysteresis);
+}
+
+static void voter_stream_release(struct voter_stream *stream)
+{
+	queue_read(&stream->queue, NULL, stream->queue.bytes);
+	stream->used = false;
+	if (voter.selected == stream)
+		voter.selected = NULL;
+}
+
+static struct voter_stream *voter_stream_get(uint8_t from[6], uint8_t transmission, uint64_t now)
+{
+	struct voter_stream *stream, *oldest = &voter.streams[0];
+	uint64_t start = voter.out;
+	bool active = false;
+	int i;
+
+	for (i = 0; i < VOTER_STREAMS; i++) {
+		stream = &voter.streams[i];
+		if (!stream->used) {
+			oldest = stream;
+			continue;
+		}
+		if (stream->transmission == transmission &&
+		    !memcmp(stream->from, from, 6))
+			return stream;
+		if (oldest->used && stream->last < oldest->last)
+			oldest = stream;
+		if (stream->start + stream->queue.bytes > start)
+			start = stream->start + stream->queue.bytes;
+		if (now - stream->last < voter.window_usec)
+			active = true;
+	}
+
+	if (!active) {
+		voter.event_start = voter.out;
+		voter.event_time = now;
+		start = voter.out;
+	} else if (now - voter.event_time < voter.window_usec) {
+		start = voter.event_start;
+	}
+
+	stream = oldest;
+	if (stream->used)
+		voter_stream_release(stream);
+	stream->used = true;
+	memcpy(stream->from, from, 6);
+	stream->transmission = transmission;
+	stream->start = start;
+
+	return stream;
+}
+
+static void voter_run(uint64_t now)
+{
+	size_t frame = voter.frame_bytes;
+	int i;
+
+	if (!frame)
+		return;
+	if (!now)
+		now = jitter_now();
+
+	/* Give all receivers a chance to start */
+	if (voter.out == voter.event_start &&
+	    now - voter.event_time < voter.window_usec)
+		return;
+
+	while (1) {
+		struct voter_stream *best = NULL;
+		double best_level = -INFINITY;
+		uint64_t arrival = now;
+		bool complete = true;
+
+		for (i = 0; i < VOTER_STREAMS; i++) {
+			struct voter_stream *stream = &voter.streams[i];
+
+			if (!stream->used)
+				continue;
+
+			/* Drop data for frames already played out */
+			if (stream->start < voter.out) {
+				uint64_t skip = voter.out - stream->start;
+
+				if (skip > stream->queue.bytes)
+					skip = stream->queue.bytes;
+				queue_read(&stream->queue, NULL, skip);
+				stream->start += skip;
+			}
+
+			if (stream->start + stream->queue.bytes < voter.out + frame) {
+				if (now - stream->last > VOTER_STREAM_IDLE) {
+					voter_stream_release(stream);
+				} else if (stream->start <= voter.out &&
+				    now - stream->last < voter.window_usec) {
+					/* Still sending, worth waiting for */
+					complete = false;
+				}
+				continue;
+			}
+			/* Starts after this frame */
+			if (stream->start > voter.out)
+				continue;
+
+			if (stream->queue.head->arrival < arrival)
+				arrival = stream->queue.head->arrival;
+
+			double level = stream->queue.head->level_dbm;
+			if (stream == voter.selected)
+				level += voter.hysteresis;
+			if (!best || level > best_level) {
+				best = stream;
+				best_level = level;
+			}
+		}
+
+		if (!best)
+			return;
+		/* Wait for the others, counted from the first arrival */
+		if (!complete) {
+			if (now - arrival < voter.window_usec)
+				return;
+			voter.late++;
+		}
+
+		struct tx_packet *packet = tx_packet_alloc(frame);
+		if (!packet)
+			return;
+		memcpy(packet->from, best->from, 6);
+		packet->local_rx = best->queue.head->local_rx;
+		packet->level_dbm = best->queue.head->level_dbm;
+		packet->len = queue_read(&best->queue, packet->data, frame);
+		best->start += packet->len;
+		voter.out += frame;
+
+		voter.frames++;
+		if (voter.selected != best) {
+			if (voter.selected)
+				voter.switches++;
+			voter.selected = best;
+		}
+		queue_enqueue(&queue_voice, packet);
+	}
+}
+
+static int voter_enqueue(struct tx_packet *packet, uint8_t transmission, double level_dbm)
+{
+	uint64_t now = jitter_now();
+	struct voter_stream *stream = voter_stream_get(packet->from, transmission, now);
+
+	jitter_arrival(packet, transmission);
+
+	packet->level_dbm = level_dbm;
+	packet->arrival = now;
+	stream->last = now;
+	queue_enqueue(&stream->queue, packet);
+
+	voter_run(now);
+
+	return 1;
 }
 
 int enqueue_voice(struct tx_packet *packet, uint8_t transmission, double level_dbm)
 {
-	if (queue_voice && transmission != voice_transmission) {
+	if (voter.frame_bytes)
+		return voter_enqueue(packet, transmission, level_dbm);
+
+	if (queue_voice.head && transmission != voice_transmission) {
 		if (level_dbm < voice_level) {
 			tx_packet_free(packet);
 			return 0;
@@ -87,26 +815,31 @@ int enqueue_voice(struct tx_packet *packet, uint8_t transmission, double level_d
 	voice_transmission = transmission;
 	voice_level = level_dbm;
 
-	packet->next = NULL;
-	*queue_voice_tail = packet;
-	queue_voice_tail = &packet->next;
+	jitter_arrival(packet, transmission);
 
-	return 1;
+	return queue_enqueue(&queue_voice, packet);
+}
+
+size_t dequeue_voice_bytes(uint8_t *data, size_t len)
+{
+	return queue_read(&queue_voice, data, len);
 }
 
 bool queue_voice_filled(size_t min_len)
 {
-	size_t len = 0;
-	struct tx_packet *entry;
-	
-	for (entry = queue_voice; entry; entry = entry->next) {
-		len += entry->len;
-		if (len >= min_len) {
-			return true;
-		}
-	}
-	
-	return false;
+	voter_run(0);
+
+	return queue_filled(&queue_voice, min_len);
+}
+
+size_t queue_voice_bytes(void)
+{
+	return queue_voice.bytes;
+}
+
+size_t queue_voice_packets(void)
+{
+	return queue_voice.packets;
 }
 
 void queue_voice_end(uint8_t transmission)
@@ -115,146 +848,216 @@ void queue_voice_end(uint8_t transmission)
 		voice_level = -INFINITY;
 }
 
-static struct tx_packet *queue_baseband = NULL;
-static struct tx_packet **queue_baseband_tail = &queue_baseband;
+/* Baseband samples for the second output channel.
+   A ring of samples with a spill area behind it. A read that wraps around
+   copies the wrapped part into the spill area, so the reader always gets
+   a contiguous view and the queue never needs to be reshaped.
+ */
+#define BASEBAND_RING_SIZE	32768	/* samples, power of two */
+#define BASEBAND_SPILL_SIZE	8192	/* samples, largest single read */
+
+static int16_t baseband_ring[BASEBAND_RING_SIZE + BASEBAND_SPILL_SIZE];
+static size_t baseband_head;
+static size_t baseband_tail;
+static size_t baseband_max = BASEBAND_RING_SIZE;
+static enum queue_drop baseband_drop = QUEUE_DROP_NEWEST;
+static uint64_t baseband_dropped;
 
-struct tx_packet *dequeue_baseband(void)
+/* Append nr samples, or silence if samples is NULL */
+static void baseband_write(int16_t *samples, size_t nr)
 {
-	struct tx_packet *packet;
-	
-	packet = queue_baseband;
-	queue_baseband = packet->next;
-	if (&packet->next == queue_baseband_tail) {
-		queue_baseband_tail = &queue_baseband;
+	size_t pos = baseband_head & (BASEBAND_RING_SIZE - 1);
+	size_t first = BASEBAND_RING_SIZE - pos;
+
+	if (first > nr)
+		first = nr;
+	if (samples) {
+		memcpy(baseband_ring + pos, samples, first * sizeof(int16_t));
+		memcpy(baseband_ring, samples + first, (nr - first) * sizeof(int16_t));
+	} else {
+		memset(baseband_ring + pos, 0, first * sizeof(int16_t));
+		memset(baseband_ring, 0, (nr - first) * sizeof(int16_t));
 	}
-	return packet;
+	baseband_head += nr;
 }
 
-struct tx_packet *peek_baseband(void)
+void enqueue_baseband(struct tx_packet *packet)
 {
-	return queue_baseband;
+	int16_t *samples = (int16_t *)packet->data;
+	size_t nr = packet->len / sizeof(int16_t);
+	size_t fill = baseband_head - baseband_tail;
+
+	if (nr > baseband_max) {
+		/* Longer than the whole queue: keep the newest or the
+		   oldest part, as the drop policy says */
+		baseband_dropped += nr - baseband_max;
+		if (baseband_drop == QUEUE_DROP_OLDEST)
+			samples += nr - baseband_max;
+		nr = baseband_max;
+	}
+	if (fill + nr > baseband_max) {
+		size_t over = fill + nr - baseband_max;
+
+		baseband_dropped += over;
+		if (baseband_drop == QUEUE_DROP_OLDEST)
+			baseband_tail += over;
+		else
+			nr -= over;
+	}
+	baseband_write(samples, nr);
+
+	tx_packet_free(packet);
 }
 
-void enqueue_baseband(struct tx_packet *packet)
+int16_t *dequeue_baseband_exact(size_t nr)
 {
-	packet->next = NULL;
-	*queue_baseband_tail = packet;
-	queue_baseband_tail = &packet->next;
+	size_t fill = baseband_head - baseband_tail;
+	size_t pos = baseband_tail & (BASEBAND_RING_SIZE - 1);
+
+	if (!fill || nr > BASEBAND_SPILL_SIZE)
+		return NULL;
+
+	/* Pad with silence */
+	if (fill < nr)
+		baseband_write(NULL, nr - fill);
+
+	if (pos + nr > BASEBAND_RING_SIZE) {
+		memcpy(baseband_ring + BASEBAND_RING_SIZE, baseband_ring,
+		    (pos + nr - BASEBAND_RING_SIZE) * sizeof(int16_t));
+	}
+	baseband_tail += nr;
+
+	return baseband_ring + pos;
 }
 
 bool queue_baseband_filled(void)
 {
-	return queue_baseband;
+	return baseband_head != baseband_tail;
 }
 
-void ensure_baseband(size_t nr)
+size_t queue_baseband_bytes(void)
 {
-	struct tx_packet *packet = queue_baseband;
-	
-	if (packet->len == nr)
-		return;
-	
-	if (packet->len > nr) {
-		struct tx_packet *p2 = tx_packet_alloc();
-		size_t new_nr = packet->len - nr;
-		
-		p2->local_rx = packet->local_rx;
-		memcpy(p2->data, packet->data + nr, new_nr);
-		p2->len = new_nr;
-		
-		packet->len = nr;
-		p2->next = packet->next;
-		packet->next = p2->next;
-	} else {
-		while (packet->next) {
-			struct tx_packet *p2 = packet->next;
-			size_t nr_extra = nr - packet->len;
-
-			if (nr_extra > p2->len)
-				nr_extra = p2->len;
-			memcpy(packet->data + packet->len, p2->data, nr_extra);
-			packet->len += nr_extra;
-			
-			size_t nr_off = p2->len - nr_extra;
-			if (!nr_off) {
-				packet->next = p2->next;
-				tx_packet_free(p2);
-			} else {
-				memmove(p2->data, p2->data + nr_extra, nr_off);
-				p2->len = nr_off;
-			}
-			
-			if (packet->len == nr)
-				return;
-		}
-		size_t nr_zero = nr - packet->len;
-		memset(packet->data + packet->len, 0, nr_zero);
-		packet->len = nr;
-	}
+	return (baseband_head - baseband_tail) * sizeof(int16_t);
 }
 
 
-static struct tx_packet *queue_data = NULL;
-static struct tx_packet **queue_data_tail = &queue_data;
-
 struct tx_packet *dequeue_data(void)
 {
-	struct tx_packet *packet;
-	
-	packet = queue_data;
-	queue_data = packet->next;
-	if (&packet->next == queue_data_tail) {
-		queue_data_tail = &queue_data;
-	}
-	return packet;
+	return queue_dequeue(&queue_data);
 }
 
 struct tx_packet *peek_data(void)
 {
-	return queue_data;
+	return queue_data.head;
 }
 
 void enqueue_data(struct tx_packet *packet)
 {
-	packet->next = NULL;
-	*queue_data_tail = packet;
-	queue_data_tail = &packet->next;
+	queue_enqueue(&queue_data, packet);
 }
 
 bool queue_data_filled(void)
 {
-	return queue_data;
+	return queue_data.head;
 }
 
+size_t queue_data_bytes(void)
+{
+	return queue_data.bytes;
+}
+
+size_t queue_data_packets(void)
+{
+	return queue_data.packets;
+}
 
-static struct tx_packet *queue_control = NULL;
-static struct tx_packet **queue_control_tail = &queue_control;
 
 struct tx_packet *dequeue_control(void)
 {
-	struct tx_packet *packet;
-	
-	packet = queue_control;
-	queue_control = packet->next;
-	if (&packet->next == queue_control_tail) {
-		queue_control_tail = &queue_control;
-	}
-	return packet;
+	return queue_dequeue(&queue_control);
 }
 
 struct tx_packet *peek_control(void)
 {
-	return queue_control;
+	return queue_control.head;
 }
 
 void enqueue_control(struct tx_packet *packet)
 {
-	packet->next = NULL;
-	*queue_control_tail = packet;
-	queue_control_tail = &packet->next;
+	queue_enqueue(&queue_control, packet);
 }
 
 bool queue_control_filled(void)
 {
-	return queue_control;
+	return queue_control.head;
+}
+
+size_t queue_control_bytes(void)
+{
+	return queue_control.bytes;
+}
+
+size_t queue_control_packets(void)
+{
+	return queue_control.packets;
+}
+
+static void queue_limit(char *name, struct queue *q, size_t max_bytes, char *drop)
+{
+	q->max_bytes = max_bytes;
+	q->drop = strcmp(drop, "newest") ? QUEUE_DROP_OLDEST : QUEUE_DROP_NEWEST;
+
+	if (max_bytes)
+		printf("TX queue %s: max %zd bytes, drop %s\n", name, max_bytes,
+		    q->drop == QUEUE_DROP_OLDEST ? "oldest" : "newest");
+	else
+		printf("TX queue %s: no limit\n", name);
+}
+
+void queue_limits_init(size_t voice_bytes_per_sec, size_t baseband_bytes_per_sec)
+{
+	int voice_msec = atoi(freedv_eth_config_value("tx_queue_voice_max", NULL, "1000"));
+	char *voice_drop = freedv_eth_config_value("tx_queue_voice_drop", NULL, "oldest");
+	int baseband_msec = atoi(freedv_eth_config_value("tx_queue_baseband_max", NULL, "1000"));
+	char *bb_drop = freedv_eth_config_value("tx_queue_baseband_drop", NULL, "oldest");
+	int data_max = atoi(freedv_eth_config_value("tx_queue_data_max", NULL, "16384"));
+	char *data_drop = freedv_eth_config_value("tx_queue_data_drop", NULL, "newest");
+	int control_max = atoi(freedv_eth_config_value("tx_queue_control_max", NULL, "1024"));
+	char *control_drop = freedv_eth_config_value("tx_queue_control_drop", NULL, "newest");
+
+	queue_limit("voice", &queue_voice, (uint64_t)voice_msec * voice_bytes_per_sec / 1000, voice_drop);
+	queue_limit("data", &queue_data, data_max, data_drop);
+	queue_limit("control", &queue_control, control_max, control_drop);
+
+	/* The ring itself is the upper limit for baseband */
+	baseband_max = (uint64_t)baseband_msec * baseband_bytes_per_sec / 1000 / sizeof(int16_t);
+	if (!baseband_max || baseband_max > BASEBAND_RING_SIZE)
+		baseband_max = BASEBAND_RING_SIZE;
+	baseband_drop = strcmp(bb_drop, "newest") ? QUEUE_DROP_OLDEST : QUEUE_DROP_NEWEST;
+	printf("TX queue baseband: max %zd samples, drop %s\n", baseband_max,
+	    baseband_drop == QUEUE_DROP_OLDEST ? "oldest" : "newest");
+}
+
+static void queue_print(char *name, struct queue *q)
+{
+	printf("\t%s%zd bytes in %zd packets, dropped %" PRIu64 " packets (%" PRIu64 " bytes)\n",
+	    name, q->bytes, q->packets, q->dropped_packets, q->dropped_bytes);
+}
+
+void queue_stats_print(void)
+{
+	printf("Queues:\n");
+	queue_print("voice:    ", &queue_voice);
+	printf("\tbaseband: %zd bytes, %" PRIu64 " samples dropped\n", queue_baseband_bytes(), baseband_dropped);
+	queue_print("data:     ", &queue_data);
+	queue_print("control:  ", &queue_control);
+	if (voter.frame_bytes) {
+		printf("\tvoter: %" PRIu64 " frames, %" PRIu64 " switches, %" PRIu64 " after the window\n",
+		    voter.frames, voter.switches, voter.late);
+	}
+	if (jitter.frame_bytes) {
+		printf("\tvoice jitter: %.0f usec, target %" PRIu64 " usec, %" PRIu64 " underruns, %" PRIu64 " frames concealed\n",
+		    jitter.stream ? jitter.stream->jitter : 0.0, jitter_target_usec(),
+		    jitter.underruns, jitter.concealed_total);
+	}
 }
@@ -0,0 +1,184 @@
+/*
+	Copyright Jeroen Vreeken (jeroen@vreeken.net), 2026
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "freedv_eth.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+
+/* Single producer, single consumer ring.
+   The producer only writes head, the consumer only writes tail. Both
+   are free running counters, the entry index is the counter masked
+   with the (power of two) ring size.
+   Each put also bumps an eventfd so the consumer can sleep in poll().
+ */
+struct tx_ring {
+	int fd;
+	uint32_t mask;
+
+	/* Producer side */
+	_Atomic uint32_t head __attribute__((__aligned__(64)));
+	_Atomic uint64_t put;
+	_Atomic uint64_t dropped;
+
+	/* Consumer side */
+	_Atomic uint32_t tail __attribute__((__aligned__(64)));
+	uint32_t fill_max;
+
+	struct tx_ring_entry entry[] __attribute__((__aligned__(64)));
+};
+
+struct tx_ring *tx_ring_create(int nr)
+{
+	struct tx_ring *ring;
+	uint32_t size = 1;
+
+	while (size < nr)
+		size <<= 1;
+
+	ring = aligned_alloc(64,
+	    (sizeof(struct tx_ring) + sizeof(struct tx_ring_entry) * size + 63) & ~63);
+	if (!ring)
+		goto err_alloc;
+
+	ring->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring->fd < 0)
+		goto err_fd;
+
+	ring->mask = size - 1;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->put, 0);
+	atomic_init(&ring->dropped, 0);
+	atomic_init(&ring->tail, 0);
+	ring->fill_max = 0;
+
+	return ring;
+
+err_fd:
+	free(ring);
+err_alloc:
+	return NULL;
+}
+
+int tx_ring_fd(struct tx_ring *ring)
+{
+	return ring->fd;
+}
+
+static void tx_ring_entry_free(struct tx_ring_entry *entry)
+{
+	if (entry->packet)
+		tx_packet_free(entry->packet);
+	if (entry->baseband)
+		tx_packet_free(entry->baseband);
+}
+
+int tx_ring_put(struct tx_ring *ring, struct tx_ring_entry *entry)
+{
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	uint64_t one = 1;
+
+	if (head - tail > ring->mask) {
+		tx_ring_entry_free(entry);
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return -1;
+	}
+
+	ring->entry[head & ring->mask] = *entry;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	atomic_fetch_add_explicit(&ring->put, 1, memory_order_relaxed);
+
+	if (write(ring->fd, &one, sizeof(one)) != sizeof(one))
+		return -1;
+
+	return 0;
+}
+
+void tx_ring_entry_enqueue(struct tx_ring_entry *entry)
+{
+	switch (entry->queue) {
+		case TX_RING_VOICE:
+			if (enqueue_voice(entry->packet, entry->transmission, entry->level_dbm)) {
+				if (entry->baseband)
+					enqueue_baseband(entry->baseband);
+			} else if (entry->baseband) {
+				tx_packet_free(entry->baseband);
+			}
+			break;
+		case TX_RING_VOICE_END:
+			queue_voice_end(entry->transmission);
+			break;
+		case TX_RING_BASEBAND:
+			enqueue_baseband(entry->packet);
+			break;
+		case TX_RING_DATA:
+			enqueue_data(entry->packet);
+			break;
+		case TX_RING_CONTROL:
+			enqueue_control(entry->packet);
+			break;
+	}
+}
+
+int tx_ring_consume(struct tx_ring *ring, void (*cb)(struct tx_ring_entry *entry, void *arg), void *arg)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t head;
+	uint64_t cnt;
+	int nr = 0;
+
+	/* Clear the eventfd first, a put after this wakes us again */
+	if (read(ring->fd, &cnt, sizeof(cnt)) < 0)
+		cnt = 0;
+
+	head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	if (head - tail > ring->fill_max)
+		ring->fill_max = head - tail;
+
+	while (tail != head) {
+		cb(&ring->entry[tail & ring->mask], arg);
+		tail++;
+		nr++;
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+
+	return nr;
+}
+
+static void tx_ring_drain_cb(struct tx_ring_entry *entry, void *arg)
+{
+	tx_ring_entry_enqueue(entry);
+}
+
+int tx_ring_drain(struct tx_ring *ring)
+{
+	return tx_ring_consume(ring, tx_ring_drain_cb, NULL);
+}
+
+void tx_ring_stats_print(struct tx_ring *ring, char *name)
+{
+	printf("%s ring: size %" PRIu32 ", put %" PRIu64 ", dropped %" PRIu64 ", max fill %" PRIu32 "\n",
+	    name, ring->mask + 1,
+	    atomic_load_explicit(&ring->put, memory_order_relaxed),
+	    atomic_load_explicit(&ring->dropped, memory_order_relaxed),
+	    ring->fill_max);
+}
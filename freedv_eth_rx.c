@@ -45,6 +45,7 @@ static uint8_t transmission = 128;
 static double level_dbm = -80.0;
 
 static uint8_t rx_add[6], mac[6];
+static struct interface *iface;
 
 #define RX_SYNC_ZERO 15.0
 #define RX_SYNC_DATABONUS 40.0
@@ -108,7 +109,7 @@ static void freedv_eth_rx_rawdata(int ret, unsigned char *packed_codec_bits)
 				printf("Reset RX add\n");
 				memcpy(rx_add, mac, 6);
 				cdc_voice = false;
-				queue_voice_end(transmission);
+				freedv_eth_voice_end(transmission);
 				transmission++;
 			}
 }
@@ -181,7 +182,8 @@ void freedv_eth_rx_cb_datarx(void *arg, unsigned char *packet, size_t size)
 		/* Filter out our own packets if they come back */
 		if (memcmp(packet+6, mac, 6)) {
 			uint16_t type = (packet[12] << 8) | packet[13];
-			interface_rx_raw(packet, packet+6, type, packet + 14, size - 14);
+			/* The header is already in front of the data */
+			interface_rx_raw_headroom(iface, packet, packet+6, type, packet + 14, size - 14);
 			printf("^\n");
 		}
 	}
@@ -200,7 +202,7 @@ void freedv_eth_rx_vc_callback(void *arg, char c)
 		printf("VC RX: 0x%x %c\n", c, c);
 	msg[0] = c;
 	msg[1] = 0;
-	interface_rx(bcast, rx_add, ETH_P_AR_CONTROL, msg, 1, 0, 1);
+	interface_rx(iface, bcast, rx_add, ETH_P_AR_CONTROL, msg, 1, 0, 1);
 }
 
 static void create_silence_packet(struct CODEC2 *c2)
@@ -223,9 +225,10 @@ static void create_silence_packet(struct CODEC2 *c2)
 }
 
 
-int freedv_eth_rx_init(struct freedv *init_freedv, uint8_t init_mac[6], int hw_rate)
+int freedv_eth_rx_init(struct freedv *init_freedv, uint8_t init_mac[6], int hw_rate, struct interface *init_iface)
 {
 	freedv = init_freedv;
+	iface = init_iface;
 	int nr_samples;
 	int f_rate = freedv_get_modem_sample_rate(freedv);
 
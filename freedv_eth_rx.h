@@ -25,7 +25,9 @@
 #include <codec2/freedv_api.h>
 #include <eth_ar/eth_ar.h>
 
-int freedv_eth_rx_init(struct freedv *freedv, uint8_t mac[6], int hw_rate);
+struct interface;
+
+int freedv_eth_rx_init(struct freedv *freedv, uint8_t mac[6], int hw_rate, struct interface *iface);
 void freedv_eth_rx(int16_t *samples, int nr);
 bool freedv_eth_rx_cdc(void);
 
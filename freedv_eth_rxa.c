@@ -32,6 +32,7 @@
 
 static struct emphasis *emphasis_d = NULL;
 static uint8_t mac[ETH_AR_MAC_SIZE];
+static struct interface *iface;
 static uint8_t bcast[ETH_AR_MAC_SIZE] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
 static bool dtmf_initialized = false;
 static bool cdc;
@@ -78,7 +79,7 @@ static void cb_control(char *ctrl)
 	}
 	printf("DTMF: %s\n", ctrl);
 	
-	interface_rx(bcast, mac, ETH_P_AR_CONTROL, msg, strlen(ctrl), 0, 1);
+	interface_rx(iface, bcast, mac, ETH_P_AR_CONTROL, msg, strlen(ctrl), 0, 1);
 }
 
 
@@ -114,7 +115,7 @@ void freedv_eth_rxa(int16_t *samples, int nr)
 		new_cdc = ctcss_detect_rx(samples, nr);
 	}
 	if (cdc && !new_cdc) {
-		queue_voice_end(transmission);
+		freedv_eth_voice_end(transmission);
 		transmission++;
 	}
 
@@ -136,7 +137,7 @@ void freedv_eth_rxa(int16_t *samples, int nr)
 	}
 }
 
-int freedv_eth_rxa_init(int hw_rate, uint8_t mac_init[ETH_AR_MAC_SIZE], int hw_nr)
+int freedv_eth_rxa_init(int hw_rate, uint8_t mac_init[ETH_AR_MAC_SIZE], int hw_nr, struct interface *iface_init)
 {
 	double ctcss_freq = atof(freedv_eth_config_value("analog_rx_ctcss_frequency", NULL, "0.0"));
 	bool emphasis = atoi(freedv_eth_config_value("analog_rx_emphasis", NULL, "0"));
@@ -145,6 +146,7 @@ int freedv_eth_rxa_init(int hw_rate, uint8_t mac_init[ETH_AR_MAC_SIZE], int hw_n
 
 	rx_gain = rx_gain_init;
 	memcpy(mac, mac_init, 6);
+	iface = iface_init;
 	printf("RXA rx_gain: %f\n", rx_gain);
 
 	int msec_samples = hw_rate / 1000;
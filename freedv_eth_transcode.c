@@ -17,6 +17,7 @@
  */
 
 #include "freedv_eth.h"
+#include "freedv_eth_config.h"
 #include "eth_ar_codec2.h"
 #include "eth_ar/alaw.h"
 #include "eth_ar/ulaw.h"
@@ -25,36 +26,159 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
-struct freedv_eth_transcode {
-	struct CODEC2 *trans_enc;
-	struct CODEC2 *trans_dec;
-	short *trans_speech;
-	int trans_speech_size;
-	int trans_speech_pos;
-	int trans_dec_mode;
-	int trans_enc_mode;
-	int trans_enc_samples_frame;
-	int trans_enc_bytes_frame;
-	int trans_dec_bytes_frame;
-	int trans_rate_native;
+/* Longest packet the transcoder handles, in msec of audio. Scratch
+   buffers are sized for this at the highest rate, so transcoding a
+   packet never allocates. Only a new codec or resampler does, on the
+   first packet after a mode change. */
+#define TRANSCODE_MSEC_MAX	512
+/* Samples left over from an earlier packet, less than a codec2 frame */
+#define TRANSCODE_CARRY_MAX	1024
+/* Distinct output rates and codec2 encoders kept at the same time */
+#define TRANSCODE_RATE_MAX	3
+#define TRANSCODE_ENC_MAX	4
+/* Idle codecs and resamplers kept for reuse by other sources */
+#define TRANSCODE_POOL_MAX	16
+
+/* A resampler from the source rate to one output rate */
+struct transcode_rate {
+	int rate;
 	struct sound_resample *sr;
 	int sr_rate_in;
-	int sr_rate_out;
+	int nr;
+	unsigned long gen;
+};
+
+/* A codec2 encoder keeps the samples short of a whole frame */
+struct transcode_enc {
+	int mode;
+	struct CODEC2 *enc;
+	int samples_frame;
+	int bytes_frame;
+	short carry[TRANSCODE_CARRY_MAX];
+	int carry_pos;
+	unsigned long gen;
+};
+
+/* Transcoder state of one stream, keyed by sender and type so
+   interleaved streams do not share codec or resampler state */
+struct transcode_source {
+	uint8_t from[6];
+	uint16_t type;
+	bool used;
+	unsigned long last;
+
+	struct CODEC2 *dec;
+	int dec_mode;
+	int dec_bytes_frame;
+
+	struct transcode_rate rate[TRANSCODE_RATE_MAX];
+	struct transcode_enc enc[TRANSCODE_ENC_MAX];
+
+	/* Targets of the previous packet, for allocation accounting */
+	int last_to[TRANSCODE_ENC_MAX];
+	int last_nr;
+};
+
+struct transcode_codec {
+	int mode;
+	struct CODEC2 *codec;
+};
+
+struct transcode_resample {
+	int rate_in;
+	int rate_out;
+	struct sound_resample *sr;
+};
+
+struct freedv_eth_transcode {
+	int trans_rate_native;
+
+	struct transcode_source *source;
+	int sources;
+	unsigned long source_last;
+
+	/* Warm instances not used by any source */
+	struct transcode_codec codec_pool[TRANSCODE_POOL_MAX];
+	int codec_pool_nr;
+	struct transcode_resample sr_pool[TRANSCODE_POOL_MAX];
+	int sr_pool_nr;
+
+	/* Decoded input of the current packet, either in speech_in or
+	   directly in the packet for native samples */
+	short *speech;
+	short *speech_in;
+	int speech_in_size;
+	int samples_in;
+	int from_rate;
+	/* Input resampled to each of the source rates */
+	short *speech_rate[TRANSCODE_RATE_MAX];
+	/* Bumped for each decoded packet */
+	unsigned long gen;
+
+	/* Accounting */
+	unsigned long packets;
+	unsigned long decodes;
+	unsigned long allocs;
+	unsigned long allocs_warm;
+	unsigned long evictions;
 };
 
 struct freedv_eth_transcode *freedv_eth_transcode_init(int native_rate)
 {
-	printf("Transcode native audio rate: %d\n", native_rate);
+	int i;
+	int sources = atoi(freedv_eth_config_value("transcode_sources", NULL, "8"));
+
+	if (sources < 1)
+		sources = 1;
+	printf("Transcode native audio rate: %d, %d sources\n", native_rate, sources);
 
 	struct freedv_eth_transcode *tc = calloc(1, sizeof(struct freedv_eth_transcode));
+	if (!tc)
+		goto err_tc;
 	
-	tc->trans_dec_mode = -1;
-	tc->trans_enc_mode = -1;
-
 	tc->trans_rate_native = native_rate;
+
+	tc->sources = sources;
+	tc->source = calloc(sources, sizeof(struct transcode_source));
+	if (!tc->source)
+		goto err_source;
+
+	int rate_max = native_rate > 16000 ? native_rate : 16000;
+	tc->speech_in_size = TRANSCODE_MSEC_MAX * rate_max / 1000;
+	tc->speech_in = calloc(tc->speech_in_size, sizeof(short));
+	if (!tc->speech_in)
+		goto err_speech;
+	for (i = 0; i < TRANSCODE_RATE_MAX; i++) {
+		tc->speech_rate[i] = calloc(tc->speech_in_size, sizeof(short));
+		if (!tc->speech_rate[i])
+			goto err_speech;
+	}
 	
 	return tc;
+
+err_speech:
+	for (i = 0; i < TRANSCODE_RATE_MAX; i++)
+		free(tc->speech_rate[i]);
+	free(tc->speech_in);
+	free(tc->source);
+err_source:
+	free(tc);
+err_tc:
+	return NULL;
+}
+
+void freedv_eth_transcode_stats_print(struct freedv_eth_transcode *tc, char *name)
+{
+	printf("Transcode %s: %lu packets, %lu decodes, %lu allocations, %lu after warm-up, %lu evictions\n",
+	    name, tc->packets, tc->decodes, tc->allocs, tc->allocs_warm, tc->evictions);
 }
 
 static inline int eth_ar_codec_rate(struct freedv_eth_transcode *tc, int mode)
@@ -82,185 +206,427 @@ static inline int eth_ar_codec_rate(struct freedv_eth_transcode *tc, int mode)
 }
 
 
-int freedv_eth_transcode(struct freedv_eth_transcode *tc, struct tx_packet *packet, int to_codecmode, uint16_t from_type)
+/* Take a codec from the pool, only create one if there is none */
+static struct CODEC2 *transcode_codec_get(struct freedv_eth_transcode *tc, int mode)
 {
-	int from_codecmode = eth_ar_eth_p_codecmode(from_type);
-	int samples_in;
-	int from_rate = eth_ar_codec_rate(tc, from_codecmode);
-	int to_rate = eth_ar_codec_rate(tc, to_codecmode);
+	int i;
 
-	if (to_codecmode == from_codecmode)
+	for (i = 0; i < tc->codec_pool_nr; i++) {
+		if (tc->codec_pool[i].mode == mode) {
+			struct CODEC2 *codec = tc->codec_pool[i].codec;
+			tc->codec_pool[i] = tc->codec_pool[--tc->codec_pool_nr];
+			return codec;
+		}
+	}
+	tc->allocs++;
+	return codec2_create(mode);
+}
+
+static void transcode_codec_put(struct freedv_eth_transcode *tc, int mode, struct CODEC2 *codec)
+{
+	if (!codec)
+		return;
+	if (tc->codec_pool_nr == TRANSCODE_POOL_MAX) {
+		codec2_destroy(codec);
+		return;
+	}
+	tc->codec_pool[tc->codec_pool_nr].mode = mode;
+	tc->codec_pool[tc->codec_pool_nr].codec = codec;
+	tc->codec_pool_nr++;
+}
+
+static struct sound_resample *transcode_sr_get(struct freedv_eth_transcode *tc, int rate_in, int rate_out)
+{
+	struct sound_resample *sr;
+	int i;
+
+	for (i = 0; i < tc->sr_pool_nr; i++) {
+		if (tc->sr_pool[i].rate_in == rate_in && tc->sr_pool[i].rate_out == rate_out) {
+			sr = tc->sr_pool[i].sr;
+			tc->sr_pool[i] = tc->sr_pool[--tc->sr_pool_nr];
+			sound_resample_reset(sr);
+			return sr;
+		}
+	}
+	printf("Transcode with resample: %d -> %d\n", rate_in, rate_out);
+	tc->allocs++;
+	sr = sound_resample_create(rate_out, rate_in);
+	if (sr)
+		sound_resample_reserve(sr, tc->speech_in_size);
+	return sr;
+}
+
+static void transcode_sr_put(struct freedv_eth_transcode *tc, int rate_in, int rate_out, struct sound_resample *sr)
+{
+	if (!sr)
+		return;
+	if (tc->sr_pool_nr == TRANSCODE_POOL_MAX) {
+		sound_resample_destroy(sr);
+		return;
+	}
+	tc->sr_pool[tc->sr_pool_nr].rate_in = rate_in;
+	tc->sr_pool[tc->sr_pool_nr].rate_out = rate_out;
+	tc->sr_pool[tc->sr_pool_nr].sr = sr;
+	tc->sr_pool_nr++;
+}
+
+/* Hand everything a source holds back to the pools */
+static void transcode_source_release(struct freedv_eth_transcode *tc, struct transcode_source *src)
+{
+	int i;
+
+	transcode_codec_put(tc, src->dec_mode, src->dec);
+	for (i = 0; i < TRANSCODE_ENC_MAX; i++)
+		transcode_codec_put(tc, src->enc[i].mode, src->enc[i].enc);
+	for (i = 0; i < TRANSCODE_RATE_MAX; i++)
+		transcode_sr_put(tc, src->rate[i].sr_rate_in, src->rate[i].rate, src->rate[i].sr);
+}
+
+/* Find the state of a stream, the least recently used one is taken
+   over by a new stream */
+static struct transcode_source *transcode_source(struct freedv_eth_transcode *tc, uint8_t from[6], uint16_t type)
+{
+	struct transcode_source *src = NULL;
+	int i;
+
+	for (i = 0; i < tc->sources; i++) {
+		struct transcode_source *s = &tc->source[i];
+
+		if (s->used && s->type == type && !memcmp(s->from, from, 6)) {
+			src = s;
+			goto found;
+		}
+		if (!src || (src->used && (!s->used || s->last < src->last)))
+			src = s;
+	}
+
+	if (src->used) {
+		transcode_source_release(tc, src);
+		tc->evictions++;
+	}
+	memset(src, 0, sizeof(struct transcode_source));
+	memcpy(src->from, from, 6);
+	src->type = type;
+	src->used = true;
+	src->dec_mode = -1;
+	for (i = 0; i < TRANSCODE_ENC_MAX; i++)
+		src->enc[i].mode = -1;
+	src->last_nr = -1;
+
+found:
+	src->last = ++tc->source_last;
+	return src;
+}
+
+/* A new packet for the result, returns the room it has */
+static size_t transcode_room(struct tx_packet **packetp, size_t size)
+{
+	if (size > tx_packet_max())
+		size = tx_packet_max();
+	*packetp = tx_packet_alloc(size);
+	if (!*packetp)
 		return 0;
 
+	return (*packetp)->size < size ? (*packetp)->size : size;
+}
+
+/* Samples of the other byte order, swapped while copying */
+static void transcode_swap16(short *out, uint8_t *in, int nr)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+	for (; i + 8 <= nr; i += 8) {
+		__m128i v = _mm_loadu_si128((__m128i *)(in + i * 2));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *)(out + i), v);
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 8 <= nr; i += 8) {
+		uint8x16_t v = vld1q_u8(in + i * 2);
+		vst1q_s16(out + i, vreinterpretq_s16_u8(vrev16q_u8(v)));
+	}
+#endif
+	for (; i < nr; i++) {
+		uint16_t v;
+
+		memcpy(&v, in + i * 2, sizeof(v));
+		out[i] = __builtin_bswap16(v);
+	}
+}
+
+/* Decode a packet at its own rate. Native samples are used in place,
+   data stays untouched until all targets are encoded. */
+static void transcode_decode(struct freedv_eth_transcode *tc, struct transcode_source *src,
+    int from_codecmode, uint8_t *data, size_t len)
+{
+	int from_rate = eth_ar_codec_rate(tc, from_codecmode);
+	int samples_max = TRANSCODE_MSEC_MAX * from_rate / 1000;
+	short *speech_in = tc->speech_in;
+	int samples_in;
+
+	tc->gen++;
+	tc->decodes++;
+	tc->from_rate = from_rate;
+	tc->speech = speech_in;
+
 	switch(from_codecmode) {
 		case CODEC_MODE_ALAW:
 		case CODEC_MODE_ULAW:
-			samples_in = packet->len;
+			samples_in = len;
 			break;
 		case CODEC_MODE_LE16:
 		case CODEC_MODE_BE16:
-			samples_in = packet->len / 2;
+			samples_in = len / 2;
 			break;
 		default: {
-			if (from_codecmode != tc->trans_dec_mode) {
-				if (tc->trans_dec)
-					codec2_destroy(tc->trans_dec);
-				tc->trans_dec_mode = from_codecmode;
-				tc->trans_dec = codec2_create(tc->trans_dec_mode);
-				tc->trans_dec_bytes_frame = codec2_bits_per_frame(tc->trans_dec);
-				tc->trans_dec_bytes_frame += 7;
-				tc->trans_dec_bytes_frame /= 8;
+			if (from_codecmode != src->dec_mode) {
+				transcode_codec_put(tc, src->dec_mode, src->dec);
+				src->dec_mode = from_codecmode;
+				src->dec = transcode_codec_get(tc, src->dec_mode);
+				src->dec_bytes_frame = codec2_bits_per_frame(src->dec);
+				src->dec_bytes_frame += 7;
+				src->dec_bytes_frame /= 8;
 			}
-			int frames = packet->len / tc->trans_dec_bytes_frame;
-			samples_in = codec2_samples_per_frame(tc->trans_dec) * frames;
+			int samples_frame = codec2_samples_per_frame(src->dec);
+			int frames = len / src->dec_bytes_frame;
+			if (frames > samples_max / samples_frame)
+				frames = samples_max / samples_frame;
+			samples_in = samples_frame * frames;
 			break;
 		}
 	}
-
-	short *speech_in = malloc(sizeof(short)*(samples_in));
+	if (samples_in > samples_max)
+		samples_in = samples_max;
+	tc->samples_in = samples_in;
 	
 	switch (from_codecmode) {
 		case CODEC_MODE_ALAW:
-			alaw_decode(speech_in, packet->data, samples_in);
+			alaw_decode(speech_in, data, samples_in);
 			break;
 		case CODEC_MODE_ULAW:
-			ulaw_decode(speech_in, packet->data, samples_in);
+			ulaw_decode(speech_in, data, samples_in);
 			break;
-		case CODEC_MODE_LE16: {
-			/* Fill packet with native short samples */
-			union {
-				uint8_t b[2];
-				uint16_t s;
-			} b2s;
-			int i;
-			for (i = 0; i < samples_in; i++) {
-				b2s.b[0] = packet->data[i * 2 + 0];
-				b2s.b[1] = packet->data[i * 2 + 1];
-				speech_in[i] = le16toh(b2s.s);
-			}
-			break;
-		}
-		case CODEC_MODE_BE16: {
-			/* Fill packet with native short samples */
-			union {
-				uint8_t b[2];
-				uint16_t s;
-			} b2s;
-			int i;
-			for (i = 0; i < samples_in; i++) {
-				b2s.b[0] = packet->data[i * 2 + 0];
-				b2s.b[1] = packet->data[i * 2 + 1];
-				speech_in[i] = be16toh(b2s.s);
-			}
+		case CODEC_MODE_LE16:
+		case CODEC_MODE_BE16:
+			if (from_codecmode != CODEC_MODE_NATIVE16)
+				transcode_swap16(speech_in, data, samples_in);
+			else if (!((uintptr_t)data % sizeof(short)))
+				/* Already what we need */
+				tc->speech = (short *)data;
+			else
+				memcpy(speech_in, data, samples_in * sizeof(short));
 			break;
-		}
 		default: {
+			int samples_frame = codec2_samples_per_frame(src->dec);
 			int cbytes = 0;
 			int i;
-			for (i = 0; i < samples_in; i+= codec2_samples_per_frame(tc->trans_dec)) {
-				codec2_decode(tc->trans_dec, speech_in + i, packet->data + cbytes);
-				cbytes += tc->trans_dec_bytes_frame;
+			for (i = 0; i + samples_frame <= samples_in; i += samples_frame) {
+				codec2_decode(src->dec, speech_in + i, data + cbytes);
+				cbytes += src->dec_bytes_frame;
 			}
 			break;
 		}
 	}
+}
 
-	int samples_out = 0;
-	if (to_rate == from_rate) {
-		samples_out = samples_in;
-		if (tc->sr) {
-			sound_resample_destroy(tc->sr);
-			tc->sr = NULL;
-		}
-	} else {
-		if (tc->sr_rate_in != from_rate || tc->sr_rate_out != to_rate) {
-			if (tc->sr) {
-				sound_resample_destroy(tc->sr);
-				tc->sr = NULL;
-			}
-		}
-		if (!tc->sr) {
-			printf("Transcode with resample: %d -> %d\n", from_rate, to_rate);
-			tc->sr_rate_in = from_rate;
-			tc->sr_rate_out = to_rate;
-			tc->sr = sound_resample_create(tc->sr_rate_out, tc->sr_rate_in);
-		}
-		if (tc->sr) {
-			samples_out = sound_resample_nr_out(tc->sr, samples_in);
+/* The decoded packet at to_rate, resampled at most once per packet */
+static short *transcode_rate(struct freedv_eth_transcode *tc, struct transcode_source *src, int to_rate, int *nr)
+{
+	struct transcode_rate *rate = NULL;
+	int i;
+
+	if (to_rate == tc->from_rate) {
+		*nr = tc->samples_in;
+		return tc->speech;
+	}
+
+	for (i = 0; i < TRANSCODE_RATE_MAX; i++) {
+		if (src->rate[i].rate == to_rate) {
+			rate = &src->rate[i];
+			break;
 		}
+		/* Reuse the one unused for the longest time */
+		if (!rate || src->rate[i].gen < rate->gen)
+			rate = &src->rate[i];
+	}
+	short *speech = tc->speech_rate[rate - src->rate];
+	if (rate->gen == tc->gen && rate->rate == to_rate) {
+		*nr = rate->nr;
+		return speech;
+	}
+
+	if (rate->rate != to_rate || rate->sr_rate_in != tc->from_rate) {
+		transcode_sr_put(tc, rate->sr_rate_in, rate->rate, rate->sr);
+		rate->rate = to_rate;
+		rate->sr_rate_in = tc->from_rate;
+		rate->sr = transcode_sr_get(tc, tc->from_rate, to_rate);
+	}
+	rate->gen = tc->gen;
+	rate->nr = 0;
+	if (rate->sr) {
+		rate->nr = sound_resample_nr_out(rate->sr, tc->samples_in);
+		if (rate->nr > tc->speech_in_size)
+			rate->nr = tc->speech_in_size;
+		sound_resample_perform(rate->sr, speech, tc->speech, rate->nr, tc->samples_in);
 	}
 
-	if (tc->trans_speech_pos + samples_out > tc->trans_speech_size) {
-		short *tmp = realloc(tc->trans_speech, sizeof(short)*(tc->trans_speech_pos + samples_out));
-		if (!tmp)
-			return -1;
-		tc->trans_speech = tmp;
-		tc->trans_speech_size = tc->trans_speech_pos + samples_out;
+	*nr = rate->nr;
+	return speech;
+}
+
+static struct transcode_enc *transcode_enc(struct freedv_eth_transcode *tc, struct transcode_source *src, int mode)
+{
+	struct transcode_enc *enc = NULL;
+	int i;
+
+	for (i = 0; i < TRANSCODE_ENC_MAX; i++) {
+		if (src->enc[i].mode == mode) {
+			enc = &src->enc[i];
+			break;
+		}
+		if (!enc || src->enc[i].gen < enc->gen)
+			enc = &src->enc[i];
 	}
-	short *speech_out = tc->trans_speech + tc->trans_speech_pos;
-	if (!tc->sr) {
-		memcpy(speech_out, speech_in, samples_out);
-	} else {
-		sound_resample_perform(tc->sr, speech_out, speech_in, samples_out, samples_in);
+	if (enc->mode != mode) {
+		transcode_codec_put(tc, enc->mode, enc->enc);
+		enc->mode = mode;
+		enc->enc = transcode_codec_get(tc, mode);
+		enc->samples_frame = codec2_samples_per_frame(enc->enc);
+		enc->bytes_frame = codec2_bits_per_frame(enc->enc);
+		enc->bytes_frame += 7;
+		enc->bytes_frame /= 8;
+		enc->carry_pos = 0;
 	}
-	tc->trans_speech_pos += samples_out;
+	enc->gen = tc->gen;
 
+	return enc;
+}
 
-	free(speech_in);
+/* Encode the decoded packet into a new packet */
+static void transcode_encode(struct freedv_eth_transcode *tc, struct transcode_source *src,
+    struct tx_packet **packetp, int to_codecmode)
+{
+	struct tx_packet *packet;
+	int nr;
+	short *speech = transcode_rate(tc, src, eth_ar_codec_rate(tc, to_codecmode), &nr);
 
 	switch(to_codecmode) {
 		case CODEC_MODE_ALAW: {
-			if (tc->trans_speech_pos > tx_packet_max())
-				tc->trans_speech_pos = tx_packet_max();
-			alaw_encode(packet->data, tc->trans_speech, tc->trans_speech_pos);
-			packet->len = tc->trans_speech_pos;
-			tc->trans_speech_pos = 0;
-		
+			nr = transcode_room(packetp, nr);
+			packet = *packetp;
+			if (!packet)
+				break;
+			alaw_encode(packet->data, speech, nr);
+			packet->len = nr;
 			break;
 		}
 		case CODEC_MODE_ULAW: {
-			if (tc->trans_speech_pos > tx_packet_max())
-				tc->trans_speech_pos = tx_packet_max();
-			ulaw_encode(packet->data, tc->trans_speech, tc->trans_speech_pos);
-			packet->len = tc->trans_speech_pos;
-			tc->trans_speech_pos = 0;
-		
+			nr = transcode_room(packetp, nr);
+			packet = *packetp;
+			if (!packet)
+				break;
+			ulaw_encode(packet->data, speech, nr);
+			packet->len = nr;
 			break;
 		}
 		case CODEC_MODE_NATIVE16: {
 			/* Fill packet with native short samples */
-			if (tc->trans_speech_pos > tx_packet_max())
-				tc->trans_speech_pos = tx_packet_max();
-			memcpy(packet->data, tc->trans_speech, tc->trans_speech_pos * sizeof(short));
-			packet->len = tc->trans_speech_pos * sizeof(short);
-			tc->trans_speech_pos = 0;
+			nr = transcode_room(packetp, nr * sizeof(short)) / sizeof(short);
+			packet = *packetp;
+			if (!packet)
+				break;
+			memcpy(packet->data, speech, nr * sizeof(short));
+			packet->len = nr * sizeof(short);
 			break;
 		}
-		default: 
-			if (to_codecmode != tc->trans_enc_mode) {
-				if (tc->trans_enc)
-					codec2_destroy(tc->trans_enc);
-				tc->trans_enc_mode = to_codecmode;
-				tc->trans_enc = codec2_create(tc->trans_enc_mode);
-				tc->trans_enc_samples_frame = codec2_samples_per_frame(tc->trans_enc);
-				tc->trans_enc_bytes_frame = codec2_bits_per_frame(tc->trans_enc);
-				tc->trans_enc_bytes_frame += 7;
-				tc->trans_enc_bytes_frame /= 8;
-			}
+		default: {
+			struct transcode_enc *enc = transcode_enc(tc, src, to_codecmode);
+			int frames = (enc->carry_pos + nr) / enc->samples_frame;
+			size_t room = transcode_room(packetp, frames * enc->bytes_frame);
+			packet = *packetp;
+			if (!packet)
+				break;
 			packet->len = 0;
 		
 			int off = 0;
-			while (tc->trans_speech_pos - off >= tc->trans_enc_samples_frame) {
-				codec2_encode(tc->trans_enc, packet->data + packet->len, tc->trans_speech + off);
-				off += tc->trans_enc_samples_frame;
-				packet->len += tc->trans_enc_bytes_frame;
-			}
-			if (off && off != tc->trans_speech_pos) {
-				memmove(tc->trans_speech, tc->trans_speech + off, sizeof(short)*(tc->trans_speech_pos - off));
+			while (enc->carry_pos + nr - off >= enc->samples_frame &&
+			    packet->len + enc->bytes_frame <= room) {
+				if (enc->carry_pos) {
+					/* Complete the frame started by an earlier packet */
+					int fill = enc->samples_frame - enc->carry_pos;
+					memcpy(enc->carry + enc->carry_pos, speech + off, sizeof(short) * fill);
+					codec2_encode(enc->enc, packet->data + packet->len, enc->carry);
+					enc->carry_pos = 0;
+					off += fill;
+				} else {
+					codec2_encode(enc->enc, packet->data + packet->len, speech + off);
+					off += enc->samples_frame;
+				}
+				packet->len += enc->bytes_frame;
 			}
-			tc->trans_speech_pos -= off;
+			int left = nr - off;
+			if (left > TRANSCODE_CARRY_MAX - enc->carry_pos)
+				left = TRANSCODE_CARRY_MAX - enc->carry_pos;
+			memcpy(enc->carry + enc->carry_pos, speech + off, sizeof(short) * left);
+			enc->carry_pos += left;
 			break;
+		}
 	}
+}
+
+/* Only the first packet of a source or after a mode change may allocate */
+static void transcode_warm_check(struct freedv_eth_transcode *tc, struct transcode_source *src,
+    unsigned long allocs, struct freedv_eth_transcode_target *target, int nr)
+{
+	bool same = src->last_nr == nr;
+	int i;
+
+	for (i = 0; i < nr && i < TRANSCODE_ENC_MAX; i++) {
+		if (src->last_to[i] != target[i].codecmode)
+			same = false;
+		src->last_to[i] = target[i].codecmode;
+	}
+	if (same) {
+#ifdef TRANSCODE_DEBUG
+		assert(tc->allocs == allocs);
+#endif
+		if (tc->allocs != allocs)
+			tc->allocs_warm++;
+	}
+	src->last_nr = nr;
+}
+
+int freedv_eth_transcode_fanout(struct freedv_eth_transcode *tc,
+    struct freedv_eth_transcode_target *target, int nr,
+    uint8_t from[6], uint16_t from_type, uint8_t *data, size_t len)
+{
+	int from_codecmode = eth_ar_eth_p_codecmode(from_type);
+	unsigned long allocs = tc->allocs;
+	struct transcode_source *src = NULL;
+	int i;
+
+	tc->packets++;
+
+	for (i = 0; i < nr; i++) {
+		target[i].packet = NULL;
+		if (target[i].codecmode == from_codecmode) {
+			target[i].packet = tx_packet_alloc(len);
+			if (!target[i].packet)
+				continue;
+			memcpy(target[i].packet->data, data, len);
+			target[i].packet->len = len;
+			continue;
+		}
+		if (!src) {
+			src = transcode_source(tc, from, from_type);
+			transcode_decode(tc, src, from_codecmode, data, len);
+		}
+		transcode_encode(tc, src, &target[i].packet, target[i].codecmode);
+	}
+
+	if (src)
+		transcode_warm_check(tc, src, allocs, target, nr);
 
 	return 0;
 }
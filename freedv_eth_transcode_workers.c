@@ -0,0 +1,231 @@
+/*
+	Copyright Jeroen Vreeken (jeroen@vreeken.net), 2026
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#define _GNU_SOURCE
+
+#include "freedv_eth.h"
+#include "eth_ar_codec2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+
+struct transcode_worker {
+	int nr;
+	struct transcode_workers *w;
+
+	/* Jobs from the network, results to the tx thread */
+	struct tx_ring *in;
+	struct tx_ring *out;
+	struct freedv_eth_transcode *tc;
+	pthread_t thread;
+
+	_Atomic uint64_t jobs;
+};
+
+struct transcode_workers {
+	int nr;
+	int priority;
+	int codecmode;
+	bool baseband;
+
+	struct transcode_worker worker[];
+};
+
+/* Spread senders over the workers */
+static struct transcode_worker *transcode_worker_shard(struct transcode_workers *w, uint8_t from[6])
+{
+	uint32_t hash = 0;
+	int i;
+
+	for (i = 0; i < 6; i++)
+		hash = hash * 31 + from[i];
+
+	return &w->worker[hash % w->nr];
+}
+
+static void transcode_worker_job(struct tx_ring_entry *entry, void *arg)
+{
+	struct transcode_worker *worker = arg;
+	struct transcode_workers *w = worker->w;
+	struct tx_packet *packet = entry->packet;
+	struct freedv_eth_transcode_target target[2] = {
+		{ .codecmode = w->codecmode },
+		{ .codecmode = CODEC_MODE_NATIVE16 },
+	};
+
+	freedv_eth_transcode_fanout(worker->tc, target, w->baseband ? 2 : 1,
+	    packet->from, entry->eth_type, packet->data, packet->len);
+	atomic_fetch_add_explicit(&worker->jobs, 1, memory_order_relaxed);
+
+	struct tx_packet *packet_bb = w->baseband ? target[1].packet : NULL;
+	if (!target[0].packet) {
+		if (packet_bb)
+			tx_packet_free(packet_bb);
+		tx_packet_free(packet);
+		return;
+	}
+	memcpy(target[0].packet->from, packet->from, 6);
+	if (packet_bb)
+		memcpy(packet_bb->from, packet->from, 6);
+	tx_packet_free(packet);
+
+	tx_ring_put(worker->out, &(struct tx_ring_entry){
+	    .queue = TX_RING_VOICE, .packet = target[0].packet, .baseband = packet_bb,
+	    .transmission = entry->transmission, .level_dbm = entry->level_dbm });
+}
+
+static void *transcode_worker_thread(void *arg)
+{
+	struct transcode_worker *worker = arg;
+	struct sched_param param;
+	struct pollfd fds[1];
+	int r;
+
+	param.sched_priority = worker->w->priority;
+	r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (r) {
+		printf("transcode worker %d: pthread_setschedparam() failed: %s\n",
+		    worker->nr, strerror(r));
+	}
+
+	fds[0].fd = tx_ring_fd(worker->in);
+	fds[0].events = POLLIN;
+
+	do {
+		if (poll(fds, 1, -1) < 0)
+			continue;
+
+		if (fds[0].revents & POLLIN)
+			tx_ring_consume(worker->in, transcode_worker_job, worker);
+	} while (1);
+
+	return NULL;
+}
+
+struct transcode_workers *transcode_workers_create(int nr, int native_rate,
+    int ring_size, int priority, int codecmode, bool baseband)
+{
+	struct transcode_workers *w;
+	int i;
+
+	w = calloc(1, sizeof(struct transcode_workers) + sizeof(struct transcode_worker) * nr);
+	if (!w)
+		goto err_alloc;
+
+	w->nr = nr;
+	w->priority = priority;
+	w->codecmode = codecmode;
+	w->baseband = baseband;
+
+	for (i = 0; i < nr; i++) {
+		struct transcode_worker *worker = &w->worker[i];
+
+		worker->nr = i;
+		worker->w = w;
+		atomic_init(&worker->jobs, 0);
+		worker->in = tx_ring_create(ring_size);
+		worker->out = tx_ring_create(ring_size);
+		worker->tc = freedv_eth_transcode_init(native_rate);
+		if (!worker->in || !worker->out || !worker->tc)
+			goto err_worker;
+	}
+	/* Only start when all are complete, the threads are never stopped */
+	for (i = 0; i < nr; i++) {
+		if (pthread_create(&w->worker[i].thread, NULL, transcode_worker_thread, &w->worker[i]))
+			goto err_thread;
+	}
+	printf("Transcode workers: %d\n", nr);
+
+	return w;
+
+err_worker:
+	printf("Could not create transcode worker %d\n", i);
+	return NULL;
+err_thread:
+	printf("Could not start transcode worker %d\n", i);
+	return NULL;
+err_alloc:
+	return NULL;
+}
+
+int transcode_workers_put(struct transcode_workers *w, struct tx_ring_entry *entry)
+{
+	struct transcode_worker *worker = transcode_worker_shard(w, entry->packet->from);
+
+	return tx_ring_put(worker->in, entry);
+}
+
+int transcode_workers_poll_count(struct transcode_workers *w)
+{
+	return w->nr;
+}
+
+int transcode_workers_poll_fill(struct transcode_workers *w, struct pollfd *fds, int count)
+{
+	int i;
+
+	for (i = 0; i < count && i < w->nr; i++) {
+		fds[i].fd = tx_ring_fd(w->worker[i].out);
+		fds[i].events = POLLIN;
+	}
+	return 0;
+}
+
+bool transcode_workers_poll_in(struct transcode_workers *w, struct pollfd *fds, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (fds[i].revents & POLLIN)
+			return true;
+	}
+	return false;
+}
+
+int transcode_workers_drain(struct transcode_workers *w)
+{
+	int nr = 0;
+	int i;
+
+	for (i = 0; i < w->nr; i++)
+		nr += tx_ring_drain(w->worker[i].out);
+
+	return nr;
+}
+
+void transcode_workers_stats_print(struct transcode_workers *w)
+{
+	char name[32];
+	int i;
+
+	for (i = 0; i < w->nr; i++) {
+		struct transcode_worker *worker = &w->worker[i];
+
+		printf("Transcode worker %d: %" PRIu64 " jobs\n", i,
+		    atomic_load_explicit(&worker->jobs, memory_order_relaxed));
+		snprintf(name, sizeof(name), "worker %d", i);
+		freedv_eth_transcode_stats_print(worker->tc, name);
+		snprintf(name, sizeof(name), "worker %d in", i);
+		tx_ring_stats_print(worker->in, name);
+		snprintf(name, sizeof(name), "worker %d out", i);
+		tx_ring_stats_print(worker->out, name);
+	}
+}
@@ -43,6 +43,7 @@ static uint8_t bcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
 static uint8_t mac[6];
 static uint8_t tx_add[6];
 static int bytes_per_freedv_frame;
+static int usec_per_freedv_frame;
 static int bytes_per_codec2_frame;
 static bool vc_busy = false;
 static bool fullduplex;
@@ -70,14 +71,7 @@ static struct emphasis *deemph_state = NULL;
 
 static int tx_sound_out(int16_t *samples, int nr)
 {
-	int16_t *samples1 = NULL;
-
-	struct tx_packet *packet = peek_baseband();
-	if (packet) {
-		ensure_baseband(nr*sizeof(int16_t));
-		packet = dequeue_baseband();
-		samples1 = (int16_t*)packet->data;
-	}
+	int16_t *samples1 = dequeue_baseband_exact(nr);
 	
 	if (!sr0) {
 		sound_out_lr(samples, samples1, nr);
@@ -102,10 +96,6 @@ static int tx_sound_out(int16_t *samples, int nr)
 		sound_out_lr(hw0, hw1, nr_out);
 	}
 
-	if (packet) {
-		tx_packet_free(packet);
-	}
-
 	return 0;
 }
 
@@ -170,30 +160,11 @@ static void data_tx(void)
 static void tx_voice(void)
 {
 	check_tx_add();
-	struct tx_packet *packet = dequeue_voice();
-	uint8_t *data = packet->data;
-	size_t len = 0;
 
-	unsigned char frame_data[bytes_per_freedv_frame];
-	size_t frame_len = 0;
+	unsigned char data[bytes_per_freedv_frame];
 	
-	while (len < bytes_per_freedv_frame) {
-		size_t copy = bytes_per_freedv_frame - frame_len;
-		struct tx_packet *packet = peek_voice();
-		
-		if (packet->len < copy)
-			copy = packet->len;
-		
-		memcpy(frame_data + frame_len, packet->data, copy);
-		frame_len += copy;
-		
-		if (packet->len > copy) {
-			memmove(packet->data, packet->data + copy, packet->len - copy);
-		} else {
-			dequeue_voice();
-			tx_packet_free(packet);	
-		}
-	}
+	/* Exactly one codec frame, concealed when the queue ran dry */
+	dequeue_voice_frame(data);
 	
 	bool fprs_late = nmea && tx_state_fprs_cnt >= tx_fprs && nmea->position_valid;
 	bool header_late = tx_state_data_header_cnt >= tx_header;
@@ -234,6 +205,16 @@ static void tx_voice(void)
 }
 
 
+size_t freedv_eth_tx_frame_bytes(void)
+{
+	return bytes_per_freedv_frame;
+}
+
+int freedv_eth_tx_frame_usec(void)
+{
+	return usec_per_freedv_frame;
+}
+
 char freedv_eth_tx_vc_callback(void *arg)
 {
 	char c;
@@ -287,7 +268,7 @@ void freedv_eth_tx_state_machine(void)
 	tx_state_cnt++;
 	switch (tx_state) {
 		case TX_STATE_OFF:
-			if ((queue_voice_filled(bytes_per_freedv_frame) || queue_data_filled()) && (!freedv_eth_cdc() || fullduplex)) {
+			if ((queue_voice_ready() || queue_data_filled()) && (!freedv_eth_cdc() || fullduplex)) {
 //				printf("OFF -> DELAY\n");
 				tx_state = TX_STATE_DELAY;
 				tx_state_cnt = 0;
@@ -308,14 +289,14 @@ void freedv_eth_tx_state_machine(void)
 				tx_state_data_header_cnt = 0;
 				tx_state_fprs_cnt = tx_fprs - tx_header - 1;
 			}
-			if (queue_voice_filled(bytes_per_freedv_frame)) {
+			if (queue_voice_ready()) {
 				tx_voice();
 			} else {
 				data_tx();
 			}
 			break;
 		case TX_STATE_ON:
-			if (!queue_voice_filled(bytes_per_freedv_frame) &&
+			if (!queue_voice_ready() &&
 			    !queue_data_filled() && freedv_data_ntxframes(freedv) <= 1 &&
 			    !vc_busy) {
 //				printf("ON -> TAIL\n");
@@ -324,7 +305,7 @@ void freedv_eth_tx_state_machine(void)
 			}
 			tx_state_data_header_cnt++;
 			tx_state_fprs_cnt++;
-			if (queue_voice_filled(bytes_per_freedv_frame)) {
+			if (queue_voice_ready()) {
 				tx_voice();
 			} else {
 				data_tx();
@@ -338,14 +319,14 @@ void freedv_eth_tx_state_machine(void)
 				set_ptt = true;
 				ptt = IO_HL_PTT_OFF;
 			} else {
-				if (queue_voice_filled(bytes_per_freedv_frame) || queue_data_filled()) {
+				if (queue_voice_ready() || queue_data_filled()) {
 //					printf("TAIL -> ON\n");
 					tx_state = TX_STATE_ON;
 					tx_state_cnt = 0;
 					
 					check_tx_add();
 				}
-				if (queue_voice_filled(bytes_per_freedv_frame)) {
+				if (queue_voice_ready()) {
 					tx_voice();
 				} else {
 					data_tx();
@@ -474,6 +455,8 @@ int freedv_eth_tx_init(struct freedv *init_freedv, uint8_t init_mac[6],
 	printf("TX header: %d periods\n", tx_header);
 	printf("TX header max: %d periods\n", tx_header_max);
 
+	usec_per_freedv_frame = 1000000LL * freedv_get_n_nom_modem_samples(freedv) / freedv_rate;
+
 	nom_modem_samples = freedv_get_n_nom_modem_samples(freedv);
 	
 	free(mod_out);
@@ -59,21 +59,14 @@ struct beacon_sample *beep_2k;
 
 static int tx_sound_out(int16_t *samples0, int16_t *samples1, int nr)
 {
-	struct tx_packet *packet = peek_baseband();
-	if (!samples1 && packet) {
-		ensure_baseband(nr*sizeof(int16_t));
-		packet = dequeue_baseband();
-		samples1 = (int16_t*)packet->data;
-	}
+	if (!samples1)
+		samples1 = dequeue_baseband_exact(nr);
 
 	if (samples0)
 		sound_gain(samples0, nr, amp);
 
 	sound_out_lr(samples0, samples1, nr);
 	
-	if (packet) {
-		tx_packet_free(packet);
-	}
 	return 0;
 }
 
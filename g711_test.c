@@ -0,0 +1,180 @@
+/*
+	Copyright Jeroen Vreeken (jeroen@vreeken.net), 2026
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <eth_ar/alaw.h>
+#include <eth_ar/ulaw.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+static int16_t samples[65536];
+static int16_t samples_ref[65536];
+static uint8_t codes[65536];
+static uint8_t codes_ref[65536];
+
+static void test_fill(void)
+{
+	int i;
+	
+	for (i = 0; i < 65536; i++)
+		samples[i] = i - 32768;
+}
+
+static int test_encode(char *name,
+    void (*encode)(uint8_t *, int16_t *, int),
+    void (*encode_ref)(uint8_t *, int16_t *, int))
+{
+	int i;
+	
+	test_fill();
+	encode(codes, samples, 65536);
+	encode_ref(codes_ref, samples, 65536);
+	
+	for (i = 0; i < 65536; i++) {
+		if (codes[i] != codes_ref[i]) {
+			fprintf(stderr, "%s_encode(%d) -> 0x%02x != 0x%02x\n",
+			    name, samples[i], codes[i], codes_ref[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int test_decode(char *name,
+    void (*decode)(int16_t *, uint8_t *, int),
+    void (*decode_ref)(int16_t *, uint8_t *, int))
+{
+	int i;
+	
+	for (i = 0; i < 256; i++)
+		codes[i] = i;
+	decode(samples, codes, 256);
+	decode_ref(samples_ref, codes, 256);
+	
+	for (i = 0; i < 256; i++) {
+		if (samples[i] != samples_ref[i]) {
+			fprintf(stderr, "%s_decode(0x%02x) -> %d != %d\n",
+			    name, i, samples[i], samples_ref[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Decoding and encoding again should give the same code, full scale
+   should give the largest code */
+static int test_roundtrip(char *name,
+    void (*encode)(uint8_t *, int16_t *, int),
+    void (*decode)(int16_t *, uint8_t *, int))
+{
+	uint8_t code;
+	int16_t max[2] = { 32767, -32768 };
+	int16_t near[2] = { 32000, -32000 };
+	uint8_t codes_max[2], codes_near[2];
+	int i;
+	
+	for (i = 0; i < 256; i++) {
+		code = i;
+		decode(samples, &code, 1);
+		encode(codes, samples, 1);
+		if (codes[0] != code) {
+			/* u-law has two codes for zero */
+			if (samples[0] == 0)
+				continue;
+			fprintf(stderr, "%s 0x%02x -> %d -> 0x%02x\n",
+			    name, code, samples[0], codes[0]);
+			return -1;
+		}
+	}
+	
+	encode(codes_max, max, 2);
+	encode(codes_near, near, 2);
+	for (i = 0; i < 2; i++) {
+		if (codes_max[i] != codes_near[i]) {
+			fprintf(stderr, "%s %d -> 0x%02x != 0x%02x\n",
+			    name, max[i], codes_max[i], codes_near[i]);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int test_alaw_encode(void)
+{
+	return test_encode("alaw", alaw_encode, alaw_encode_ref);
+}
+
+static int test_alaw_decode(void)
+{
+	return test_decode("alaw", alaw_decode, alaw_decode_ref);
+}
+
+static int test_alaw_roundtrip(void)
+{
+	return test_roundtrip("alaw", alaw_encode, alaw_decode);
+}
+
+static int test_ulaw_encode(void)
+{
+	return test_encode("ulaw", ulaw_encode, ulaw_encode_ref);
+}
+
+static int test_ulaw_decode(void)
+{
+	return test_decode("ulaw", ulaw_decode, ulaw_decode_ref);
+}
+
+static int test_ulaw_roundtrip(void)
+{
+	return test_roundtrip("ulaw", ulaw_encode, ulaw_decode);
+}
+
+struct g711_test {
+	char *name;
+	int (*func)(void);
+} tests[] = {
+	{ "alaw_encode", test_alaw_encode },
+	{ "alaw_decode", test_alaw_decode },
+	{ "alaw_roundtrip", test_alaw_roundtrip },
+	{ "ulaw_encode", test_ulaw_encode },
+	{ "ulaw_decode", test_ulaw_decode },
+	{ "ulaw_roundtrip", test_ulaw_roundtrip },
+};
+
+int main(int argc, char **argv)
+{
+
+	int i;
+	int passed = 0;
+	int failed = 0;
+	
+	for (i = 0; i < sizeof(tests)/sizeof(struct g711_test); i++) {
+		int test_ret = tests[i].func();
+		
+		printf("Test: %s: %s\n", tests[i].name, test_ret ? "Failed" : "Passed");
+		if (test_ret)
+			failed++;
+		else
+			passed++;
+	}
+	
+	printf("%d passed, %d failed, Result: %s\n", passed, failed, failed ? "Failed" : "Passed");
+
+	return failed;
+}
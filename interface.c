@@ -15,10 +15,15 @@
 	along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
  */
+#define _GNU_SOURCE
 #include "interface.h"
+#include "interface_xdp.h"
+#include "interface_pcap.h"
 
 #include <arpa/inet.h>
 #include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -27,101 +32,544 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <linux/if.h>
 #include <linux/if_arp.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
 #include <linux/if_tun.h>
 
-static int fd;
-static bool outgoing = false;
+/* PACKET_MMAP (TPACKET_V3) receive ring.
+   The kernel fills blocks with frames and hands a block to us when it is
+   full or when the retire timeout expires, so a single wakeup can deliver
+   many frames without any copy or syscall per frame.
+ */
+#define RING_BLOCK_SIZE		(1 << 16)
+#define RING_BLOCK_NR		16
+#define RING_FRAME_SIZE		2048
+#define RING_RETIRE_TOV		10	/* msec */
+
+/* Queued frames for sockets, flushed with a single sendmmsg() */
+#define RXQ_FRAME_SIZE		2048
+
+/* Receive buffers for the backends that need to copy */
+#define TX_FRAME_SIZE		2048
+
+/* Room for the SO_TIMESTAMPNS control message */
+#define TX_CONTROL_SIZE		CMSG_SPACE(sizeof(struct timespec))
+
+typedef int (*interface_tx_cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level);
+
+struct interface {
+	int fd;
+	bool is_sock;
+	bool outgoing;
+	struct interface_xdp *xdp;
+	struct interface_pcap *pcap;
+
+	int (*tx_func)(struct interface *iface, size_t doff, interface_tx_cb cb, int max);
+
+	uint8_t *ring;
+	unsigned int ring_block;
+	struct tpacket3_hdr *ring_ppd;
+	unsigned int ring_pkt;
 
-int interface_rx(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level)
+	bool rxq_enable;
+	int rxq_nr;
+	uint8_t rxq_frame[INTERFACE_BURST_MAX][RXQ_FRAME_SIZE];
+	struct iovec rxq_iov[INTERFACE_BURST_MAX];
+	struct mmsghdr rxq_msg[INTERFACE_BURST_MAX];
+
+	bool filter_enable;
+	struct interface_filter filter;
+
+	struct interface_stats stats;
+
+	uint8_t tx_frame[INTERFACE_BURST_MAX][TX_FRAME_SIZE];
+};
+
+void interface_stats_count(struct interface_stats_types *types, uint16_t eth_type, size_t len)
 {
-	size_t packet_size = len + sizeof(struct eth_ar_voice_header);
-	uint8_t packet[packet_size];
+	int i;
+
+	for (i = 0; i < types->nr; i++) {
+		if (types->type[i].eth_type == eth_type)
+			goto found;
+	}
+	if (types->nr == INTERFACE_STATS_TYPES) {
+		types->other_frames++;
+		types->other_bytes += len;
+		return;
+	}
+	types->type[i].eth_type = eth_type;
+	types->nr++;
+found:
+	types->type[i].frames++;
+	types->type[i].bytes += len;
+}
+
+/* Count the time since the kernel received the frame */
+static void interface_stats_latency(struct interface *iface, struct timespec *ts)
+{
+	struct timespec now;
+	int64_t usec;
+	int bucket = 0;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	usec = (now.tv_sec - ts->tv_sec) * 1000000 + (now.tv_nsec - ts->tv_nsec) / 1000;
+
+	while (usec >= 2 && bucket < INTERFACE_STATS_LATENCY - 1) {
+		usec >>= 1;
+		bucket++;
+	}
+	iface->stats.latency[bucket]++;
+}
+
+void interface_stats_get(struct interface *iface, struct interface_stats *stats)
+{
+	*stats = iface->stats;
+}
+
+static void interface_stats_print_types(char *dir, struct interface_stats_types *types)
+{
+	int i;
+
+	for (i = 0; i < types->nr; i++) {
+		printf("\t%s 0x%04x: %" PRIu64 " frames, %" PRIu64 " bytes\n", dir,
+		    types->type[i].eth_type, types->type[i].frames, types->type[i].bytes);
+	}
+	if (types->other_frames) {
+		printf("\t%s other:  %" PRIu64 " frames, %" PRIu64 " bytes\n", dir,
+		    types->other_frames, types->other_bytes);
+	}
+}
+
+void interface_stats_print(struct interface *iface, char *name)
+{
+	struct interface_stats *stats = &iface->stats;
+	int i;
+
+	printf("Interface %s:\n", name);
+	interface_stats_print_types("in ", &stats->tx);
+	interface_stats_print_types("out", &stats->rx);
+	printf("\tshort reads: %" PRIu64 ", outgoing dropped: %" PRIu64 ", write failures: %" PRIu64 "\n",
+	    stats->tx_short, stats->tx_outgoing, stats->rx_fail);
+	for (i = 0; i < INTERFACE_STATS_LATENCY; i++) {
+		if (!stats->latency[i])
+			continue;
+		printf("\tlatency < %lu usec: %" PRIu64 "\n", 2UL << i, stats->latency[i]);
+	}
+}
+
+int interface_rx_flush(struct interface *iface)
+{
+	int sent = 0;
+
+	if (iface->xdp)
+		return interface_xdp_flush(iface->xdp);
+	if (iface->pcap)
+		return interface_pcap_flush(iface->pcap);
+	
+	while (sent < iface->rxq_nr) {
+		int r = sendmmsg(iface->fd, iface->rxq_msg + sent, iface->rxq_nr - sent, 0);
+		if (r <= 0)
+			break;
+		sent += r;
+	}
+	
+	int ret = sent < iface->rxq_nr ? -1 : 0;
+	iface->stats.rx_fail += iface->rxq_nr - sent;
+	iface->rxq_nr = 0;
+	
+	return ret;
+}
+
+/* Write a frame made up of iov parts.
+   Queued frames are gathered in a queue slot, others go to the fd with
+   writev() so the payload does not need to be copied behind the header.
+ */
+static int interface_rx_iov(struct interface *iface, struct iovec *iov, int iovcnt)
+{
+	size_t packet_size = 0;
+	int i;
 	
-	struct eth_ar_voice_header *header = (void*)packet;
+	for (i = 0; i < iovcnt; i++)
+		packet_size += iov[i].iov_len;
+
+	/* The first part always holds the complete ethernet header */
+	uint8_t *eth = iov[0].iov_base;
+	interface_stats_count(&iface->stats.rx, (eth[12] << 8) | eth[13], packet_size);
+
+	/* Frames for AF_XDP always go on its transmit ring */
+	if (iface->xdp) {
+		if (interface_xdp_rx(iface->xdp, iov, iovcnt)) {
+			iface->stats.rx_fail++;
+			return -1;
+		}
+		if (!iface->rxq_enable)
+			return interface_xdp_flush(iface->xdp);
+		return 0;
+	}
+
+	/* Capture files are buffered by stdio, a flush writes them out */
+	if (iface->pcap) {
+		if (interface_pcap_rx(iface->pcap, iov, iovcnt)) {
+			iface->stats.rx_fail++;
+			return -1;
+		}
+		if (!iface->rxq_enable)
+			return interface_pcap_flush(iface->pcap);
+		return 0;
+	}
+
+	if (iface->rxq_enable && iface->is_sock && packet_size <= RXQ_FRAME_SIZE) {
+		int nr;
+		uint8_t *packet;
+
+		if (iface->rxq_nr == INTERFACE_BURST_MAX)
+			interface_rx_flush(iface);
+
+		nr = iface->rxq_nr;
+		packet = iface->rxq_frame[nr];
+		for (i = 0; i < iovcnt; i++) {
+			memcpy(packet, iov[i].iov_base, iov[i].iov_len);
+			packet += iov[i].iov_len;
+		}
+		
+		iface->rxq_iov[nr].iov_base = iface->rxq_frame[nr];
+		iface->rxq_iov[nr].iov_len = packet_size;
+		iface->rxq_msg[nr].msg_hdr = (struct msghdr){
+			.msg_iov = &iface->rxq_iov[nr],
+			.msg_iovlen = 1,
+		};
+		iface->rxq_nr++;
+		
+		return 0;
+	}
+
+	/* Keep frames in order */
+	if (iface->rxq_nr)
+		interface_rx_flush(iface);
 	
-	memcpy(header->to, to, 6);
-	memcpy(header->from, from, 6);
+//	printf("Packet to interface %zd\n", packet_size);
+	if (writev(iface->fd, iov, iovcnt) <= 0) {
+		iface->stats.rx_fail++;
+		return 1;
+	}
+	return 0;
+}
+
+static void interface_rx_header(struct eth_ar_voice_header *header, uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t transmission, uint8_t level)
+{
+	/* memmove: to and from may already point into the header */
+	memmove(header->to, to, 6);
+	memmove(header->from, from, 6);
 	header->type = htons(eth_type);
 	header->nr = transmission;
 	header->level = level;
+}
+
+static void interface_rx_raw_header(uint8_t *header, uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type)
+{
+	/* memmove: to and from may already point into the header */
+	memmove(header, to, 6);
+	memmove(header + 6, from, 6);
+	header[12] = eth_type >> 8;
+	header[13] = eth_type & 0xff;
+}
+
+int interface_rx(struct interface *iface, uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level)
+{
+	struct eth_ar_voice_header header;
 	
-	memcpy(packet + sizeof(struct eth_ar_voice_header), data, len);
+	interface_rx_header(&header, to, from, eth_type, transmission, level);
+
+	struct iovec iov[2] = {
+		{ .iov_base = &header, .iov_len = sizeof(header) },
+		{ .iov_base = data, .iov_len = len },
+	};
 	
-//	printf("Packet to interface %zd\n", packet_size);
-	return write(fd, packet, packet_size) <= 0;
+	return interface_rx_iov(iface, iov, 2);
+}
+
+int interface_rx_raw(struct interface *iface, uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len)
+{
+	uint8_t header[14];
+	
+	interface_rx_raw_header(header, to, from, eth_type);
+
+	struct iovec iov[2] = {
+		{ .iov_base = header, .iov_len = sizeof(header) },
+		{ .iov_base = data, .iov_len = len },
+	};
+	
+	return interface_rx_iov(iface, iov, 2);
 }
-int interface_rx_raw(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len)
+
+int interface_rx_headroom(struct interface *iface, uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level)
 {
-	uint8_t packet[len + 14];
+	struct eth_ar_voice_header *header = (void*)(data - sizeof(struct eth_ar_voice_header));
+	
+	interface_rx_header(header, to, from, eth_type, transmission, level);
+
+	struct iovec iov = {
+		.iov_base = header,
+		.iov_len = len + sizeof(struct eth_ar_voice_header),
+	};
 	
-	memcpy(packet, to, 6);
-	memcpy(packet + 6, from, 6);
-	packet[12] = eth_type >> 8;
-	packet[13] = eth_type & 0xff;
+	return interface_rx_iov(iface, &iov, 1);
+}
+
+int interface_rx_raw_headroom(struct interface *iface, uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len)
+{
+	uint8_t *header = data - 14;
 	
-	memcpy(packet + 14, data, len);
+	interface_rx_raw_header(header, to, from, eth_type);
+
+	struct iovec iov = {
+		.iov_base = header,
+		.iov_len = len + 14,
+	};
 	
-//	printf("Packet to interface %zd\n", sizeof(packet));
-	return write(fd, packet, sizeof(packet)) <= 0;
+	return interface_rx_iov(iface, &iov, 1);
 }
 
-static int interface_tx_tap(size_t doff, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level))
+static int interface_tx_tap(struct interface *iface, size_t doff, interface_tx_cb cb, int max)
 {
-	uint8_t data[2048];
-	struct eth_ar_voice_header *header = (void*)data;
-	size_t len;
+	int nr;
+	int r;
+	
+	if (!max)
+		max = 1;
 	
-	len = read(fd, data, 2048);
-	if (len > doff) {
-//		int i;
-		uint16_t eth_type = ntohs(header->type);
+	/* The tap fd is non-blocking, read until it is empty */
+	for (nr = 0; nr < max; nr++) {
+		uint8_t *data = iface->tx_frame[0];
+		struct eth_ar_voice_header *header = (void*)data;
+		ssize_t len;
+	
+		len = read(iface->fd, data, TX_FRAME_SIZE);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			return -1;
+		}
+		if (len > doff) {
+			uint16_t eth_type = ntohs(header->type);
 		
-		return cb(header->to, header->from, eth_type, data + doff, len - doff, header->nr, header->level);
+			interface_stats_count(&iface->stats.tx, eth_type, len);
+			r = cb(header->to, header->from, eth_type, data + doff, len - doff, header->nr, header->level);
+			if (r < 0)
+				return r;
+		} else {
+			iface->stats.tx_short++;
+		}
 	}
 	
-	return 0;
+	return nr;
 }
 
 
-static int interface_tx_sock(size_t doff, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level))
+static int interface_tx_sock(struct interface *iface, size_t doff, interface_tx_cb cb, int max)
 {
-	uint8_t data[2048];
-	struct eth_ar_voice_header *header = (void*)data;
-	ssize_t len;
+	struct mmsghdr msg[INTERFACE_BURST_MAX];
+	struct iovec iov[INTERFACE_BURST_MAX];
+	struct sockaddr_ll addr[INTERFACE_BURST_MAX];
+	uint8_t control[INTERFACE_BURST_MAX][TX_CONTROL_SIZE];
+	int nr, i;
+	int r;
+	
+	if (!max)
+		max = 1;
+	if (max > INTERFACE_BURST_MAX)
+		max = INTERFACE_BURST_MAX;
 	
-	struct sockaddr_ll addr;
-        socklen_t addr_len = sizeof(addr);
-        
-	len = recvfrom(fd, data, 2048, 0, (struct sockaddr*)&addr, &addr_len);
+	for (i = 0; i < max; i++) {
+		iov[i].iov_base = iface->tx_frame[i];
+		iov[i].iov_len = TX_FRAME_SIZE;
+		msg[i].msg_hdr = (struct msghdr){
+			.msg_name = &addr[i],
+			.msg_namelen = sizeof(addr[i]),
+			.msg_iov = &iov[i],
+			.msg_iovlen = 1,
+			.msg_control = control[i],
+			.msg_controllen = TX_CONTROL_SIZE,
+		};
+	}
+	
+	nr = recvmmsg(iface->fd, msg, max, MSG_DONTWAIT, NULL);
+	if (nr < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		return -1;
+	}
+	if (nr == 0)
+		return -1;
 
-//	len = read(fd, data, 2048);
-	if (len > doff) {
-//		int i;
+	for (i = 0; i < nr; i++) {
+		uint8_t *data = iface->tx_frame[i];
+		struct eth_ar_voice_header *header = (void*)data;
+		size_t len = msg[i].msg_len;
+		struct cmsghdr *cmsg;
 		
-	        if (addr.sll_pkttype != PACKET_OUTGOING || outgoing) {
+		if (len <= doff) {
+			iface->stats.tx_short++;
+		} else if (addr[i].sll_pkttype == PACKET_OUTGOING && !iface->outgoing) {
+			iface->stats.tx_outgoing++;
+		} else {
 			uint16_t eth_type = ntohs(header->type);
 		
-			return cb(header->to, header->from, eth_type, data + doff, len - doff, header->nr, header->level);
+			interface_stats_count(&iface->stats.tx, eth_type, len);
+			r = cb(header->to, header->from, eth_type, data + doff, len - doff, header->nr, header->level);
+			if (r < 0)
+				return r;
+
+			for (cmsg = CMSG_FIRSTHDR(&msg[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msg[i].msg_hdr, cmsg)) {
+				if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+					interface_stats_latency(iface, (struct timespec *)CMSG_DATA(cmsg));
+			}
 		}
 	}
 	
-	if (len <= 0)
-		return -1;
-	return 0;
+	return nr;
+}
+
+static int interface_tx_sock_ring(struct interface *iface, size_t doff, interface_tx_cb cb, int max)
+{
+	int nr = 0;
+	int r = 0;
+	
+	/* Without a limit all retired blocks are handled */
+	while (!max || nr < max) {
+		struct tpacket_block_desc *pbd = (void*)(iface->ring + iface->ring_block * RING_BLOCK_SIZE);
+		
+		if (!(__atomic_load_n(&pbd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			break;
+
+		if (!iface->ring_ppd) {
+			iface->ring_ppd = (void*)((uint8_t*)pbd + pbd->hdr.bh1.offset_to_first_pkt);
+			iface->ring_pkt = 0;
+		}
+		for (; iface->ring_pkt < pbd->hdr.bh1.num_pkts && (!max || nr < max) && r >= 0; iface->ring_pkt++, nr++) {
+			struct tpacket3_hdr *ppd = iface->ring_ppd;
+			uint8_t *data = (uint8_t*)ppd + ppd->tp_mac;
+			struct eth_ar_voice_header *header = (void*)data;
+			size_t len = ppd->tp_snaplen;
+			struct sockaddr_ll *addr = (void*)((uint8_t*)ppd + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+			
+			if (len <= doff) {
+				iface->stats.tx_short++;
+			} else if (addr->sll_pkttype == PACKET_OUTGOING && !iface->outgoing) {
+				iface->stats.tx_outgoing++;
+			} else {
+				uint16_t eth_type = ntohs(header->type);
+				struct timespec ts = { ppd->tp_sec, ppd->tp_nsec };
+				
+				interface_stats_count(&iface->stats.tx, eth_type, len);
+				r = cb(header->to, header->from, eth_type, data + doff, len - doff, header->nr, header->level);
+				interface_stats_latency(iface, &ts);
+			}
+			iface->ring_ppd = (void*)((uint8_t*)ppd + ppd->tp_next_offset);
+		}
+		
+		if (iface->ring_pkt == pbd->hdr.bh1.num_pkts) {
+			/* Give block back to the kernel */
+			__atomic_store_n(&pbd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+			iface->ring_block = (iface->ring_block + 1) % RING_BLOCK_NR;
+			iface->ring_ppd = NULL;
+		}
+		/* The frame is consumed, but the burst stops */
+		if (r < 0)
+			return r;
+	}
+
+	/* Woken up without data, check if the socket is still usable */
+	if (!nr) {
+		int error = 0;
+		socklen_t error_len = sizeof(error);
+		
+		if (getsockopt(iface->fd, SOL_SOCKET, SO_ERROR, &error, &error_len) || error)
+			return -1;
+	}
+	
+	return nr;
 }
 
-static int (*interface_tx_func)(size_t doff, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level));
-int interface_tx(int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level))
+static int interface_tx_xdp(struct interface *iface, size_t doff, interface_tx_cb cb, int max)
 {
-	return interface_tx_func(sizeof(struct eth_ar_voice_header), cb);
+	/* There is no kernel filter in front of the socket, only our own
+	   XDP program, so the filter is checked here. */
+	struct interface_filter *filter = iface->filter_enable ? &iface->filter : NULL;
+
+	return interface_xdp_tx(iface->xdp, filter, &iface->stats, doff, cb, max);
 }
-int interface_tx_raw(int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len))
+
+static int interface_tx_pcap(struct interface *iface, size_t doff, interface_tx_cb cb, int max)
 {
-	return interface_tx_func(14, (void*)cb);
+	struct interface_filter *filter = iface->filter_enable ? &iface->filter : NULL;
+
+	return interface_pcap_tx(iface->pcap, filter, &iface->stats, doff, cb, max);
 }
 
+int interface_tx(struct interface *iface, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level))
+{
+	int r = iface->tx_func(iface, sizeof(struct eth_ar_voice_header), cb, 0);
+
+	return r < 0 ? r : 0;
+}
+int interface_tx_raw(struct interface *iface, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len))
+{
+	int r = iface->tx_func(iface, 14, (void*)cb, 0);
+
+	return r < 0 ? r : 0;
+}
+int interface_tx_burst(struct interface *iface, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level), int max)
+{
+	return iface->tx_func(iface, sizeof(struct eth_ar_voice_header), cb, max);
+}
+int interface_tx_raw_burst(struct interface *iface, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len), int max)
+{
+	return iface->tx_func(iface, 14, (void*)cb, max);
+}
+
+
+static void ring_free(struct interface *iface)
+{
+	if (!iface->ring)
+		return;
+	munmap(iface->ring, RING_BLOCK_SIZE * RING_BLOCK_NR);
+	iface->ring = NULL;
+}
+
+static int ring_alloc(struct interface *iface)
+{
+	int version = TPACKET_V3;
+	struct tpacket_req3 req = { 0 };
+	
+	if (setsockopt(iface->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+		return -1;
+
+	req.tp_block_size = RING_BLOCK_SIZE;
+	req.tp_block_nr = RING_BLOCK_NR;
+	req.tp_frame_size = RING_FRAME_SIZE;
+	req.tp_frame_nr = (RING_BLOCK_SIZE * RING_BLOCK_NR) / RING_FRAME_SIZE;
+	req.tp_retire_blk_tov = RING_RETIRE_TOV;
+
+	if (setsockopt(iface->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+		return -1;
+
+	iface->ring = mmap(NULL, RING_BLOCK_SIZE * RING_BLOCK_NR,
+	    PROT_READ | PROT_WRITE, MAP_SHARED, iface->fd, 0);
+	if (iface->ring == MAP_FAILED) {
+		iface->ring = NULL;
+		return -1;
+	}
+	iface->ring_block = 0;
+	iface->ring_ppd = NULL;
+	
+	return 0;
+}
 
 /* Create a socket on an existing device */
 static int sock_alloc(char *dev, uint16_t filter_type)
@@ -157,7 +605,10 @@ static int sock_alloc(char *dev, uint16_t filter_type)
 	sll.sll_protocol = protocol;
 	if(bind(sock, (struct sockaddr *)&sll , sizeof(sll)) < 0)
 		goto err_bind;
-	interface_tx_func = interface_tx_sock;
+
+	/* Kernel receive time, for the latency statistics */
+	int on = 1;
+	setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
 
 	return sock;
 err_bind:
@@ -170,8 +621,8 @@ err_socket:
 	return -1;
 }
 
-/* Create a TAP device */
-static int tap_alloc(char *dev, uint8_t mac[ETH_AR_MAC_SIZE])
+/* Create a TAP device, or attach another queue when flags has IFF_MULTI_QUEUE */
+static int tap_alloc(char *dev, uint8_t mac[ETH_AR_MAC_SIZE], short flags)
 {
 	struct ifreq ifr = { };
 	int fd;
@@ -182,7 +633,7 @@ static int tap_alloc(char *dev, uint8_t mac[ETH_AR_MAC_SIZE])
 		return -1;
 	}
 
-	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI | flags;
 
 	if (*dev) {
 		/* if a device name was specified, put it in the structure; otherwise,
@@ -209,7 +660,8 @@ static int tap_alloc(char *dev, uint8_t mac[ETH_AR_MAC_SIZE])
 		return -1;
 	}
 
-	interface_tx_func = interface_tx_tap;
+	/* Allow reading until the queue is empty */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 
 	int sock;
 	
@@ -236,20 +688,339 @@ static int tap_alloc(char *dev, uint8_t mac[ETH_AR_MAC_SIZE])
 	return fd;
 }
 
-int interface_init(char *name, uint8_t mac[ETH_AR_MAC_SIZE], bool tap, uint16_t filter_type)
+/* Filter program size: outgoing check, from check, type load, types and
+   the two return instructions */
+#define FILTER_INSN_MAX		(2 + 4 + 1 + 2 * INTERFACE_FILTER_TYPES_MAX + 2)
+#define FILTER_ACCEPT		0x40000
+
+/* Compile the filter to classic BPF and attach it to the fd */
+static int filter_attach(struct interface *iface)
+{
+	struct interface_filter *filter = &iface->filter;
+	struct sock_filter insn[FILTER_INSN_MAX];
+	bool check_outgoing = iface->is_sock && !iface->outgoing;
+	int nr = 0, len = 2;
+	int accept, drop;
+	int i;
+	
+	/* Checked in user space by interface_tx_xdp() and interface_tx_pcap() */
+	if (iface->xdp || iface->pcap)
+		return 0;
+
+	if (!iface->filter_enable) {
+		if (iface->is_sock)
+			setsockopt(iface->fd, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+		else
+			ioctl(iface->fd, TUNDETACHFILTER, NULL);
+		return 0;
+	}
+	
+	/* Count the instructions first so the jumps can be resolved */
+	if (check_outgoing)
+		len += 2;
+	if (filter->exclude_from)
+		len += 4;
+	if (filter->nr_types)
+		len++;
+	for (i = 0; i < filter->nr_types; i++)
+		len += filter->types[i].first == filter->types[i].last ? 1 : 2;
+	
+	/* Falling through the type checks means no type matched */
+	if (filter->nr_types) {
+		drop = len - 2;
+		accept = len - 1;
+	} else {
+		accept = len - 2;
+		drop = len - 1;
+	}
+
+#define FILTER_JUMP(target)	((target) - nr - 1)
+	
+	if (check_outgoing) {
+		insn[nr] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE);
+		nr++;
+		insn[nr] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, FILTER_JUMP(drop), 0);
+		nr++;
+	}
+	if (filter->exclude_from) {
+		uint8_t *from = filter->from;
+		
+		insn[nr] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 6);
+		nr++;
+		insn[nr] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+		    ((uint32_t)from[0] << 24) | (from[1] << 16) | (from[2] << 8) | from[3], 0, 2);
+		nr++;
+		insn[nr] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 10);
+		nr++;
+		insn[nr] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+		    (from[4] << 8) | from[5], FILTER_JUMP(drop), 0);
+		nr++;
+	}
+	if (filter->nr_types) {
+		insn[nr] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12);
+		nr++;
+	}
+	for (i = 0; i < filter->nr_types; i++) {
+		uint16_t first = filter->types[i].first;
+		uint16_t last = filter->types[i].last;
+		
+		if (first == last) {
+			insn[nr] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, first, FILTER_JUMP(accept), 0);
+			nr++;
+		} else {
+			insn[nr] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, first, 0, 1);
+			nr++;
+			insn[nr] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, last, 0, FILTER_JUMP(accept));
+			nr++;
+		}
+	}
+	insn[nr] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, nr == accept ? FILTER_ACCEPT : 0);
+	nr++;
+	insn[nr] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, nr == accept ? FILTER_ACCEPT : 0);
+	nr++;
+
+#undef FILTER_JUMP
+
+	struct sock_fprog prog = {
+		.len = nr,
+		.filter = insn,
+	};
+	int r;
+	
+	if (iface->is_sock)
+		r = setsockopt(iface->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+	else
+		r = ioctl(iface->fd, TUNATTACHFILTER, &prog);
+	if (r < 0) {
+		printf("Could not attach filter: %s\n", strerror(errno));
+		return -1;
+	}
+	
+	return 0;
+}
+
+int interface_filter_add_type(struct interface_filter *filter, uint16_t first, uint16_t last)
+{
+	if (filter->nr_types >= INTERFACE_FILTER_TYPES_MAX)
+		return -1;
+	
+	filter->types[filter->nr_types].first = first;
+	filter->types[filter->nr_types].last = last;
+	filter->nr_types++;
+	
+	return 0;
+}
+
+bool interface_filter_match(struct interface_filter *filter, uint8_t *frame)
+{
+	uint16_t eth_type = (frame[12] << 8) | frame[13];
+	int i;
+
+	if (filter->exclude_from && !memcmp(frame + 6, filter->from, ETH_AR_MAC_SIZE))
+		return false;
+	if (!filter->nr_types)
+		return true;
+	for (i = 0; i < filter->nr_types; i++) {
+		if (eth_type >= filter->types[i].first && eth_type <= filter->types[i].last)
+			return true;
+	}
+	return false;
+}
+
+/* All voice types: the codec2 range, 8 bit companded and 16 bit linear */
+int interface_filter_add_voice(struct interface_filter *filter)
+{
+	int r = 0;
+	
+	r |= interface_filter_add_type(filter, ETH_P_CODEC2_3200, ETH_P_LPCNET_1733);
+	r |= interface_filter_add_type(filter, ETH_P_ALAW, ETH_P_ALAW);
+	r |= interface_filter_add_type(filter, ETH_P_ULAW, ETH_P_ULAW);
+	r |= interface_filter_add_type(filter, ETH_P_LE16, ETH_P_LE16);
+	r |= interface_filter_add_type(filter, ETH_P_BE16, ETH_P_BE16);
+	
+	return r;
+}
+
+int interface_filter_set(struct interface *iface, struct interface_filter *filter)
+{
+	if (filter) {
+		if (filter->nr_types > INTERFACE_FILTER_TYPES_MAX)
+			return -1;
+		iface->filter = *filter;
+		iface->filter_enable = true;
+	} else {
+		iface->filter_enable = false;
+	}
+	
+	return filter_attach(iface);
+}
+
+static struct interface *interface_alloc(int fd, bool is_sock)
+{
+	struct interface *iface;
+
+	if (fd < 0)
+		goto err_fd;
+
+	iface = calloc(1, sizeof(struct interface));
+	if (!iface)
+		goto err_alloc;
+
+	iface->fd = fd;
+	iface->is_sock = is_sock;
+	if (is_sock)
+		iface->tx_func = interface_tx_sock;
+	else
+		iface->tx_func = interface_tx_tap;
+
+	return iface;
+err_alloc:
+	close(fd);
+err_fd:
+	return NULL;
+}
+
+static struct interface *interface_init_xdp(char *name)
+{
+	struct interface *iface;
+	struct interface_xdp *xdp;
+
+	xdp = interface_xdp_init(name);
+	if (!xdp)
+		return NULL;
+
+	iface = calloc(1, sizeof(struct interface));
+	if (!iface) {
+		interface_xdp_close(xdp);
+		return NULL;
+	}
+	iface->xdp = xdp;
+	iface->fd = interface_xdp_fd(xdp);
+	iface->tx_func = interface_tx_xdp;
+
+	return iface;
+}
+
+static struct interface *interface_init_pcap(char *uri)
+{
+	struct interface *iface;
+	struct interface_pcap *pcap;
+
+	pcap = interface_pcap_init(uri);
+	if (!pcap)
+		return NULL;
+
+	iface = calloc(1, sizeof(struct interface));
+	if (!iface) {
+		interface_pcap_close(pcap);
+		return NULL;
+	}
+	iface->pcap = pcap;
+	iface->fd = interface_pcap_fd(pcap);
+	iface->tx_func = interface_tx_pcap;
+
+	return iface;
+}
+
+struct interface *interface_init(char *name, uint8_t mac[ETH_AR_MAC_SIZE], bool tap, uint16_t filter_type)
 {
 	if (name == NULL)
 		name = "freedv";
+	/* Capture files stand in for both a tap device and a socket */
+	if (!strncmp(name, "pcap:", 5) || !strncmp(name, "pcapng:", 7))
+		return interface_init_pcap(name);
+	if (!tap && !strncmp(name, "xdp:", 4))
+		return interface_init_xdp(name + 4);
 	if (tap)
-		fd = tap_alloc(name, mac);
+		return interface_alloc(tap_alloc(name, mac, 0), false);
 	else
-		fd = sock_alloc(name, filter_type);
+		return interface_alloc(sock_alloc(name, filter_type), true);
+}
+
+int interface_init_multiqueue(char *name, uint8_t mac[ETH_AR_MAC_SIZE], int nr, struct interface *queues[])
+{
+	int i;
+
+	if (name == NULL)
+		name = "freedv";
+	/* All queues must find the same device */
+	if (!*name || nr < 1)
+		return -1;
+
+	for (i = 0; i < nr; i++) {
+		queues[i] = interface_alloc(tap_alloc(name, mac, IFF_MULTI_QUEUE), false);
+		if (!queues[i])
+			goto err_queue;
+	}
+
+	return 0;
+err_queue:
+	printf("Could not open queue %d of tap device '%s'\n", i, name);
+	while (i--)
+		interface_close(queues[i]);
+	return -1;
+}
+
+void interface_close(struct interface *iface)
+{
+	if (!iface)
+		return;
+
+	if (iface->xdp) {
+		interface_xdp_close(iface->xdp);
+	} else if (iface->pcap) {
+		interface_pcap_close(iface->pcap);
+	} else {
+		ring_free(iface);
+		close(iface->fd);
+	}
+	free(iface);
+}
+
+int interface_fd(struct interface *iface)
+{
+	return iface->fd;
+}
+
+int interface_tx_outgoing(struct interface *iface, bool enable)
+{
+	iface->outgoing = enable;
+
+	/* The filter drops outgoing frames in the kernel */
+	if (iface->filter_enable)
+		return filter_attach(iface);
+	return 0;
+}
+
+int interface_tx_ring(struct interface *iface, bool enable)
+{
+	if (!iface->is_sock)
+		return enable ? -1 : 0;
+	if (enable == (iface->ring != NULL))
+		return 0;
+
+	if (enable) {
+		if (ring_alloc(iface)) {
+			printf("Could not create receive ring: %s\n", strerror(errno));
+			return -1;
+		}
+		iface->tx_func = interface_tx_sock_ring;
+	} else {
+		struct tpacket_req3 req = { 0 };
+
+		ring_free(iface);
+		setsockopt(iface->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+		iface->tx_func = interface_tx_sock;
+	}
 	
-	return fd;
+	return 0;
 }
 
-int interface_tx_outgoing(bool enable)
+int interface_rx_queue(struct interface *iface, bool enable)
 {
-	outgoing = enable;
+	if (!enable)
+		interface_rx_flush(iface);
+	iface->rxq_enable = enable;
+
 	return 0;
 }
@@ -24,11 +24,113 @@
 
 #include "eth_ar/eth_ar.h"
 
-int interface_rx_raw(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len);
-int interface_rx(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level);
-int interface_tx_raw(int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len));
-int interface_tx(int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level));
-int interface_init(char *name, uint8_t mac[ETH_AR_MAC_SIZE], bool tap, uint16_t filter_type);
-int interface_tx_outgoing(bool enable);
+/* Maximum number of frames handled in one burst */
+#define INTERFACE_BURST_MAX	32
+
+/* Space that must be available in front of data for the *_headroom() calls,
+   the header is written there and the frame goes out without a copy. */
+#define INTERFACE_HEADROOM	16
+
+/* Kernel side frame filter, frames not matching it never wake us up */
+#define INTERFACE_FILTER_TYPES_MAX	16
+
+struct interface_filter {
+	/* Ranges of accepted ethernet types, all types when there are none */
+	int nr_types;
+	struct {
+		uint16_t first;
+		uint16_t last;
+	} types[INTERFACE_FILTER_TYPES_MAX];
+	
+	/* Drop frames coming from this address (e.g. our own) */
+	bool exclude_from;
+	uint8_t from[ETH_AR_MAC_SIZE];
+};
+
+/* Per interface counters.
+   Like the function names, tx is what is read from the network and handed
+   to the callbacks, rx is what is written to the network. */
+#define INTERFACE_STATS_TYPES		16
+#define INTERFACE_STATS_LATENCY		24
+
+struct interface_stats_types {
+	/* The first types seen, the rest is counted as other */
+	int nr;
+	struct {
+		uint16_t eth_type;
+		uint64_t frames;
+		uint64_t bytes;
+	} type[INTERFACE_STATS_TYPES];
+	uint64_t other_frames;
+	uint64_t other_bytes;
+};
+
+struct interface_stats {
+	struct interface_stats_types tx;
+	struct interface_stats_types rx;
+
+	/* Frames too short to hold the header */
+	uint64_t tx_short;
+	/* Our own outgoing frames dropped in user space, the kernel filter
+	   drops them without counting when a filter is set */
+	uint64_t tx_outgoing;
+	/* Frames that could not be written */
+	uint64_t rx_fail;
+
+	/* Time from kernel receive to callback completion, bucket n counts
+	   [2^n, 2^(n+1)) usec with everything below 2 usec in bucket 0.
+	   Only sockets have kernel timestamps. */
+	uint64_t latency[INTERFACE_STATS_LATENCY];
+};
+
+/* A single tap device or socket, a process may have several */
+struct interface;
+
+int interface_rx_raw(struct interface *iface, uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len);
+int interface_rx(struct interface *iface, uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level);
+int interface_rx_raw_headroom(struct interface *iface, uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len);
+int interface_rx_headroom(struct interface *iface, uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level);
+int interface_tx_raw(struct interface *iface, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len));
+int interface_tx(struct interface *iface, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level));
+/* Handle up to max waiting frames, returns number of frames or -1 on error.
+   A negative result of cb stops the burst and is returned. */
+int interface_tx_raw_burst(struct interface *iface, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len), int max);
+int interface_tx_burst(struct interface *iface, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level), int max);
+
+/* Returns NULL on failure.
+   A socket name of the form "xdp:<dev>[:<queue>]" uses AF_XDP on that
+   queue of the device for all eth_ar (0x73xx) frames.
+   A name of the form "pcap:<file>[,tx=<file>][,speed=<factor>]" (or
+   "pcapng:...") replays a capture file instead of using a device, see
+   interface_pcap.h. */
+struct interface *interface_init(char *name, uint8_t mac[ETH_AR_MAC_SIZE], bool tap, uint16_t filter_type);
+/* Open nr queues on one tap device. Each queue has its own handle and
+   buffers, so every queue can be serviced from its own thread. The
+   kernel filter is shared by the device, and like any tap the queues
+   have no receive ring. */
+int interface_init_multiqueue(char *name, uint8_t mac[ETH_AR_MAC_SIZE], int nr, struct interface *queues[]);
+void interface_close(struct interface *iface);
+/* File descriptor to poll for incoming frames */
+int interface_fd(struct interface *iface);
+
+int interface_filter_add_type(struct interface_filter *filter, uint16_t first, uint16_t last);
+int interface_filter_add_voice(struct interface_filter *filter);
+/* Check a frame against the filter in user space, for backends without a kernel filter */
+bool interface_filter_match(struct interface_filter *filter, uint8_t *frame);
+/* Set (or clear with NULL) the filter */
+int interface_filter_set(struct interface *iface, struct interface_filter *filter);
+
+int interface_tx_outgoing(struct interface *iface, bool enable);
+/* Use a memory mapped receive ring, only for sockets */
+int interface_tx_ring(struct interface *iface, bool enable);
+/* Queue frames written to a socket until interface_rx_flush() */
+int interface_rx_queue(struct interface *iface, bool enable);
+int interface_rx_flush(struct interface *iface);
+
+/* Copy of the current counters */
+void interface_stats_get(struct interface *iface, struct interface_stats *stats);
+void interface_stats_print(struct interface *iface, char *name);
+/* Count a frame, for the backends */
+void interface_stats_count(struct interface_stats_types *types, uint16_t eth_type, size_t len);
 
 #endif /* _INCLUDE_INTERFACE_H_ */
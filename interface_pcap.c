@@ -0,0 +1,540 @@
+/*
+	Copyright Jeroen Vreeken (jeroen@vreeken.net), 2026
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "interface_pcap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/timerfd.h>
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+#define PCAP_LINKTYPE_ETHERNET	1
+#define PCAP_SNAPLEN		65535
+
+#define PCAPNG_BLOCK_SHB	0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB	0x00000001
+#define PCAPNG_BLOCK_SPB	0x00000003
+#define PCAPNG_BLOCK_EPB	0x00000006
+#define PCAPNG_BYTE_ORDER	0x1a2b3c4d
+#define PCAPNG_OPT_TSRESOL	9
+
+#define PCAP_IF_MAX		16
+#define PCAP_BLOCK_SIZE		(PCAP_SNAPLEN + 64)
+
+#define NSEC_PER_SEC		1000000000ULL
+
+struct interface_pcap {
+	int fd;
+
+	FILE *rx;
+	bool rx_ng;
+	bool rx_swap;
+	/* Timestamp units per second, for pcapng per interface */
+	uint64_t rx_units;
+	int rx_if_nr;
+	uint64_t rx_if_units[PCAP_IF_MAX];
+	bool rx_if_ether[PCAP_IF_MAX];
+
+	FILE *tx;
+	bool tx_ng;
+
+	double speed;
+	uint64_t start;
+	uint64_t first;
+	bool started;
+
+	/* The next frame to hand out, points into block or NULL at the end */
+	uint8_t *frame;
+	size_t frame_len;
+	uint64_t frame_time;
+
+	uint8_t block[PCAP_BLOCK_SIZE];
+};
+
+static uint64_t pcap_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static uint32_t pcap_u32(struct interface_pcap *pcap, uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return pcap->rx_swap ? __builtin_bswap32(v) : v;
+}
+
+static uint16_t pcap_u16(struct interface_pcap *pcap, uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return pcap->rx_swap ? __builtin_bswap16(v) : v;
+}
+
+static uint64_t pcap_time_ns(uint64_t ts, uint64_t units)
+{
+	return (ts / units) * NSEC_PER_SEC + (double)(ts % units) * NSEC_PER_SEC / units;
+}
+
+static int pcap_skip(FILE *f, size_t len)
+{
+	return fseek(f, len, SEEK_CUR);
+}
+
+/* Load the next frame of a classic pcap file */
+static int pcap_next_pcap(struct interface_pcap *pcap)
+{
+	uint8_t hdr[16];
+
+	while (fread(hdr, sizeof(hdr), 1, pcap->rx) == 1) {
+		uint32_t sec = pcap_u32(pcap, hdr + 0);
+		uint32_t frac = pcap_u32(pcap, hdr + 4);
+		uint32_t len = pcap_u32(pcap, hdr + 8);
+
+		if (len > PCAP_BLOCK_SIZE) {
+			if (pcap_skip(pcap->rx, len))
+				break;
+			continue;
+		}
+		if (fread(pcap->block, len, 1, pcap->rx) != 1)
+			break;
+
+		pcap->frame = pcap->block;
+		pcap->frame_len = len;
+		pcap->frame_time = sec * NSEC_PER_SEC + frac * (NSEC_PER_SEC / pcap->rx_units);
+		return 0;
+	}
+
+	return -1;
+}
+
+static void pcap_ng_idb(struct interface_pcap *pcap, uint8_t *body, size_t len)
+{
+	int nr = pcap->rx_if_nr;
+	size_t pos = 8;
+
+	if (len < 8 || nr == PCAP_IF_MAX)
+		return;
+	pcap->rx_if_nr++;
+	pcap->rx_if_ether[nr] = pcap_u16(pcap, body) == PCAP_LINKTYPE_ETHERNET;
+	pcap->rx_if_units[nr] = 1000000;
+
+	while (pos + 4 <= len) {
+		uint16_t code = pcap_u16(pcap, body + pos);
+		uint16_t opt_len = pcap_u16(pcap, body + pos + 2);
+
+		pos += 4;
+		if (!code || pos + opt_len > len)
+			break;
+		if (code == PCAPNG_OPT_TSRESOL && opt_len >= 1) {
+			uint8_t res = body[pos];
+			uint64_t units = 1;
+			int i;
+
+			if (res & 0x80) {
+				units <<= res & 0x3f;
+			} else {
+				for (i = 0; i < res && i < 19; i++)
+					units *= 10;
+			}
+			pcap->rx_if_units[nr] = units;
+		}
+		pos += (opt_len + 3) & ~3;
+	}
+}
+
+/* Load the next frame of a pcapng file, other blocks are skipped */
+static int pcap_next_pcapng(struct interface_pcap *pcap)
+{
+	uint8_t hdr[8];
+
+	while (fread(hdr, sizeof(hdr), 1, pcap->rx) == 1) {
+		uint32_t type = pcap_u32(pcap, hdr + 0);
+		uint32_t len = pcap_u32(pcap, hdr + 4);
+		uint8_t *body = pcap->block;
+		size_t body_len;
+
+		if (type == PCAPNG_BLOCK_SHB) {
+			/* New section, possibly with a different byte order */
+			uint32_t bom;
+
+			if (fread(&bom, sizeof(bom), 1, pcap->rx) != 1)
+				break;
+			if (bom == PCAPNG_BYTE_ORDER)
+				pcap->rx_swap = false;
+			else if (bom == __builtin_bswap32(PCAPNG_BYTE_ORDER))
+				pcap->rx_swap = true;
+			else
+				break;
+			len = pcap_u32(pcap, hdr + 4);
+			pcap->rx_if_nr = 0;
+			if (len < 16 || pcap_skip(pcap->rx, len - 12))
+				break;
+			continue;
+		}
+
+		if (len < 12 || len & 3)
+			break;
+		body_len = len - 12;
+		if (body_len > PCAP_BLOCK_SIZE ||
+		    (type != PCAPNG_BLOCK_IDB && type != PCAPNG_BLOCK_EPB && type != PCAPNG_BLOCK_SPB)) {
+			if (pcap_skip(pcap->rx, len - 8))
+				break;
+			continue;
+		}
+		if (fread(body, body_len, 1, pcap->rx) != 1 ||
+		    pcap_skip(pcap->rx, 4))
+			break;
+
+		if (type == PCAPNG_BLOCK_IDB) {
+			pcap_ng_idb(pcap, body, body_len);
+		} else if (type == PCAPNG_BLOCK_EPB && body_len >= 20) {
+			uint32_t if_id = pcap_u32(pcap, body);
+			uint64_t ts = ((uint64_t)pcap_u32(pcap, body + 4) << 32) | pcap_u32(pcap, body + 8);
+			uint32_t cap_len = pcap_u32(pcap, body + 12);
+
+			if (if_id >= pcap->rx_if_nr || !pcap->rx_if_ether[if_id] ||
+			    cap_len > body_len - 20)
+				continue;
+			pcap->frame = body + 20;
+			pcap->frame_len = cap_len;
+			pcap->frame_time = pcap_time_ns(ts, pcap->rx_if_units[if_id]);
+			return 0;
+		} else if (type == PCAPNG_BLOCK_SPB && body_len >= 4) {
+			/* No timestamp, handed out right after the previous frame */
+			uint32_t len = pcap_u32(pcap, body);
+
+			if (!pcap->rx_if_nr || !pcap->rx_if_ether[0])
+				continue;
+			if (len > body_len - 4)
+				len = body_len - 4;
+			pcap->frame = body + 4;
+			pcap->frame_len = len;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static void pcap_next(struct interface_pcap *pcap)
+{
+	int r;
+
+	if (pcap->rx_ng)
+		r = pcap_next_pcapng(pcap);
+	else
+		r = pcap_next_pcap(pcap);
+	if (r)
+		pcap->frame = NULL;
+
+	if (pcap->frame && !pcap->started) {
+		pcap->started = true;
+		pcap->first = pcap->frame_time;
+		pcap->start = pcap_now();
+	}
+}
+
+/* Monotonic time at which the next frame should be handed out */
+static uint64_t pcap_due(struct interface_pcap *pcap)
+{
+	uint64_t offset = 0;
+
+	if (!pcap->speed)
+		return 0;
+	if (pcap->frame_time > pcap->first)
+		offset = (pcap->frame_time - pcap->first) / pcap->speed;
+
+	return pcap->start + offset;
+}
+
+/* Make the fd readable when the next frame (or the end) is due */
+static void pcap_arm(struct interface_pcap *pcap)
+{
+	struct itimerspec its = { { 0 } };
+	uint64_t due = pcap->frame ? pcap_due(pcap) : 0;
+
+	/* A zero value would disarm the timer */
+	if (due < 1)
+		due = 1;
+	its.it_value.tv_sec = due / NSEC_PER_SEC;
+	its.it_value.tv_nsec = due % NSEC_PER_SEC;
+	timerfd_settime(pcap->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int pcap_rx_open(struct interface_pcap *pcap, char *file)
+{
+	uint8_t hdr[24];
+	uint32_t magic;
+
+	pcap->rx = fopen(file, "r");
+	if (!pcap->rx) {
+		printf("Could not open capture '%s'\n", file);
+		return -1;
+	}
+	if (fread(hdr, sizeof(hdr), 1, pcap->rx) != 1)
+		goto err_format;
+
+	memcpy(&magic, hdr, sizeof(magic));
+	if (magic == PCAPNG_BLOCK_SHB) {
+		/* Restart at the section header, pcap_next() parses it */
+		pcap->rx_ng = true;
+		rewind(pcap->rx);
+		return 0;
+	}
+
+	if (magic == __builtin_bswap32(PCAP_MAGIC) ||
+	    magic == __builtin_bswap32(PCAP_MAGIC_NSEC)) {
+		pcap->rx_swap = true;
+		magic = __builtin_bswap32(magic);
+	}
+	if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC)
+		goto err_format;
+	pcap->rx_units = magic == PCAP_MAGIC_NSEC ? NSEC_PER_SEC : 1000000;
+
+	if ((pcap_u32(pcap, hdr + 20) & 0xffff) != PCAP_LINKTYPE_ETHERNET) {
+		printf("Capture '%s' does not contain ethernet frames\n", file);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+
+err_format:
+	printf("'%s' is not a pcap or pcapng capture\n", file);
+	errno = EINVAL;
+	return -1;
+}
+
+static int pcap_tx_open(struct interface_pcap *pcap, char *file)
+{
+	pcap->tx = fopen(file, "w");
+	if (!pcap->tx) {
+		printf("Could not create capture '%s'\n", file);
+		return -1;
+	}
+
+	if (pcap->tx_ng) {
+		uint32_t shb[7] = {
+			PCAPNG_BLOCK_SHB, sizeof(shb), PCAPNG_BYTE_ORDER, 1,
+			0xffffffff, 0xffffffff, sizeof(shb)
+		};
+		/* Ethernet, nanosecond timestamps */
+		uint32_t idb[8] = {
+			PCAPNG_BLOCK_IDB, sizeof(idb), 0, 0,
+			0, 0, 0, sizeof(idb)
+		};
+		uint16_t linktype[2] = { PCAP_LINKTYPE_ETHERNET, 0 };
+		uint16_t opt[2] = { PCAPNG_OPT_TSRESOL, 1 };
+
+		memcpy(&idb[2], linktype, sizeof(linktype));
+		memcpy(&idb[4], opt, sizeof(opt));
+		((uint8_t *)&idb[5])[0] = 9;
+		fwrite(shb, sizeof(shb), 1, pcap->tx);
+		fwrite(idb, sizeof(idb), 1, pcap->tx);
+	} else {
+		uint32_t hdr[6] = {
+			PCAP_MAGIC_NSEC, 0, 0, 0,
+			PCAP_SNAPLEN, PCAP_LINKTYPE_ETHERNET
+		};
+		uint16_t version[2] = { 2, 4 };
+
+		memcpy(&hdr[1], version, sizeof(version));
+		fwrite(hdr, sizeof(hdr), 1, pcap->tx);
+	}
+
+	return ferror(pcap->tx) ? -1 : 0;
+}
+
+struct interface_pcap *interface_pcap_init(char *uri)
+{
+	struct interface_pcap *pcap;
+	char *args, *arg, *saveptr;
+	char *rx_file, *tx_file = NULL;
+
+	pcap = calloc(1, sizeof(struct interface_pcap));
+	if (!pcap)
+		goto err_alloc;
+	pcap->speed = 1.0;
+
+	if (!strncmp(uri, "pcapng:", 7)) {
+		pcap->tx_ng = true;
+		uri += 7;
+	} else if (!strncmp(uri, "pcap:", 5)) {
+		uri += 5;
+	}
+	args = strdup(uri);
+	if (!args)
+		goto err_args;
+
+	rx_file = strtok_r(args, ",", &saveptr);
+	while ((arg = strtok_r(NULL, ",", &saveptr))) {
+		if (!strncmp(arg, "tx=", 3)) {
+			tx_file = arg + 3;
+		} else if (!strncmp(arg, "speed=", 6)) {
+			pcap->speed = atof(arg + 6);
+			if (pcap->speed < 0)
+				pcap->speed = 0;
+		} else {
+			printf("Unknown capture option '%s'\n", arg);
+			errno = EINVAL;
+			goto err_option;
+		}
+	}
+	if (!rx_file || !*rx_file) {
+		printf("No capture file given\n");
+		errno = EINVAL;
+		goto err_option;
+	}
+
+	pcap->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (pcap->fd < 0)
+		goto err_option;
+	if (pcap_rx_open(pcap, rx_file))
+		goto err_rx;
+	if (tx_file && pcap_tx_open(pcap, tx_file))
+		goto err_tx;
+
+	pcap_next(pcap);
+	pcap_arm(pcap);
+
+	free(args);
+	return pcap;
+
+err_tx:
+	if (pcap->tx)
+		fclose(pcap->tx);
+err_rx:
+	if (pcap->rx)
+		fclose(pcap->rx);
+	close(pcap->fd);
+err_option:
+	free(args);
+err_args:
+	free(pcap);
+err_alloc:
+	return NULL;
+}
+
+void interface_pcap_close(struct interface_pcap *pcap)
+{
+	if (pcap->tx)
+		fclose(pcap->tx);
+	fclose(pcap->rx);
+	close(pcap->fd);
+	free(pcap);
+}
+
+int interface_pcap_fd(struct interface_pcap *pcap)
+{
+	return pcap->fd;
+}
+
+int interface_pcap_tx(struct interface_pcap *pcap, struct interface_filter *filter, struct interface_stats *stats, size_t doff, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level), int max)
+{
+	uint64_t expirations;
+	uint64_t now = pcap_now();
+	int nr = 0;
+	int r = 0;
+
+	if (read(pcap->fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		return -1;
+	if (!pcap->frame)
+		return -1;
+
+	while (pcap->frame && (!max || nr < max) && pcap_due(pcap) <= now && r >= 0) {
+		uint8_t *data = pcap->frame;
+		size_t len = pcap->frame_len;
+		struct eth_ar_voice_header *header = (void*)data;
+
+		if (len <= doff || len < 14) {
+			stats->tx_short++;
+		} else if (!filter || interface_filter_match(filter, data)) {
+			uint16_t eth_type = ntohs(header->type);
+
+			interface_stats_count(&stats->tx, eth_type, len);
+			r = cb(header->to, header->from, eth_type, data + doff, len - doff, header->nr, header->level);
+		}
+		nr++;
+
+		pcap_next(pcap);
+	}
+
+	pcap_arm(pcap);
+
+	return r < 0 ? r : nr;
+}
+
+int interface_pcap_rx(struct interface_pcap *pcap, struct iovec *iov, int iovcnt)
+{
+	struct timespec ts;
+	size_t len = 0;
+	int i;
+
+	if (!pcap->tx)
+		return 0;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	if (pcap->tx_ng) {
+		uint64_t time = ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+		size_t pad = (4 - (len & 3)) & 3;
+		uint32_t block_len = 32 + len + pad;
+		uint32_t epb[7] = {
+			PCAPNG_BLOCK_EPB, block_len, 0,
+			time >> 32, time & 0xffffffff, len, len
+		};
+		uint32_t zero = 0;
+
+		fwrite(epb, sizeof(epb), 1, pcap->tx);
+		for (i = 0; i < iovcnt; i++)
+			fwrite(iov[i].iov_base, iov[i].iov_len, 1, pcap->tx);
+		fwrite(&zero, pad, 1, pcap->tx);
+		fwrite(&block_len, sizeof(block_len), 1, pcap->tx);
+	} else {
+		uint32_t hdr[4] = { ts.tv_sec, ts.tv_nsec, len, len };
+
+		fwrite(hdr, sizeof(hdr), 1, pcap->tx);
+		for (i = 0; i < iovcnt; i++)
+			fwrite(iov[i].iov_base, iov[i].iov_len, 1, pcap->tx);
+	}
+
+	return ferror(pcap->tx) ? -1 : 0;
+}
+
+int interface_pcap_flush(struct interface_pcap *pcap)
+{
+	if (!pcap->tx)
+		return 0;
+
+	return fflush(pcap->tx);
+}
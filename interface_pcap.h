@@ -0,0 +1,47 @@
+/*
+	Copyright Jeroen Vreeken (jeroen@vreeken.net), 2026
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef _INCLUDE_INTERFACE_PCAP_H_
+#define _INCLUDE_INTERFACE_PCAP_H_
+
+#include "interface.h"
+
+#include <sys/uio.h>
+
+/* Capture file backend for the interface layer, used for
+   "pcap:<file>[,tx=<file>][,speed=<factor>]" and the same with "pcapng:".
+
+   Frames are read from <file> (pcap or pcapng, detected from its contents)
+   and handed out at the pace of their capture timestamps divided by the
+   speed factor. A speed of 0 replays as fast as the application reads.
+   Written frames are appended to the tx file, in the format of the prefix.
+ */
+
+struct interface_pcap;
+
+struct interface_pcap *interface_pcap_init(char *uri);
+void interface_pcap_close(struct interface_pcap *pcap);
+int interface_pcap_fd(struct interface_pcap *pcap);
+
+/* Handle up to max (0: all) frames that are due. Returns -1 when the end
+   of the capture has been reached. */
+int interface_pcap_tx(struct interface_pcap *pcap, struct interface_filter *filter, struct interface_stats *stats, size_t doff, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level), int max);
+
+int interface_pcap_rx(struct interface_pcap *pcap, struct iovec *iov, int iovcnt);
+int interface_pcap_flush(struct interface_pcap *pcap);
+
+#endif /* _INCLUDE_INTERFACE_PCAP_H_ */
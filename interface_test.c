@@ -0,0 +1,344 @@
+/*
+	Copyright Jeroen Vreeken (jeroen@vreeken.net), 2026
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "interface.h"
+#include <eth_ar/eth_ar.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#define QUEUES 2
+
+static char *tapname = "eth_ar_mq";
+static uint8_t mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+static int test_multiqueue_open(void)
+{
+	struct interface *queues[QUEUES];
+	int r = 0;
+	int i;
+
+	if (interface_init_multiqueue(tapname, mac, QUEUES, queues))
+		return -1;
+
+	/* Every queue is its own handle with its own fd */
+	if (queues[0] == queues[1] ||
+	    interface_fd(queues[0]) < 0 || interface_fd(queues[1]) < 0 ||
+	    interface_fd(queues[0]) == interface_fd(queues[1])) {
+		fprintf(stderr, "queues share a handle or fd\n");
+		r = -1;
+	}
+
+	for (i = 0; i < QUEUES; i++)
+		interface_close(queues[i]);
+
+	return r;
+}
+
+static int test_multiqueue_filter(void)
+{
+	struct interface *queues[QUEUES];
+	struct interface_filter filter = { 0 };
+	int r = 0;
+	int i;
+
+	if (interface_init_multiqueue(tapname, mac, QUEUES, queues))
+		return -1;
+
+	/* The filter is shared by the device, setting it on every queue
+	   must work */
+	interface_filter_add_voice(&filter);
+	interface_filter_add_type(&filter, ETH_P_FPRS, ETH_P_FPRS);
+	for (i = 0; i < QUEUES; i++) {
+		if (interface_filter_set(queues[i], &filter)) {
+			fprintf(stderr, "queue %d: could not set filter\n", i);
+			r = -1;
+		}
+	}
+	if (interface_filter_set(queues[0], NULL)) {
+		fprintf(stderr, "could not clear filter\n");
+		r = -1;
+	}
+
+	for (i = 0; i < QUEUES; i++)
+		interface_close(queues[i]);
+
+	return r;
+}
+
+static int test_multiqueue_ring(void)
+{
+	struct interface *queues[QUEUES];
+	int r = 0;
+	int i;
+
+	if (interface_init_multiqueue(tapname, mac, QUEUES, queues))
+		return -1;
+
+	/* The receive ring is for packet sockets only */
+	for (i = 0; i < QUEUES; i++) {
+		if (!interface_tx_ring(queues[i], true) ||
+		    interface_tx_ring(queues[i], false)) {
+			fprintf(stderr, "queue %d: unexpected ring result\n", i);
+			r = -1;
+		}
+	}
+
+	for (i = 0; i < QUEUES; i++)
+		interface_close(queues[i]);
+
+	return r;
+}
+
+/* Packet socket on the tap device, to see it from the kernel side */
+static int packet_open(void)
+{
+	struct sockaddr_ll addr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_ALL),
+		.sll_ifindex = if_nametoindex(tapname),
+	};
+	int sock;
+
+	sock = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, htons(ETH_P_ALL));
+	if (sock < 0)
+		return -1;
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+static int test_multiqueue_write(void)
+{
+	struct interface *queues[QUEUES];
+	uint8_t bcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	bool seen[QUEUES] = { false };
+	int sock;
+	int r = 0;
+	int i;
+
+	if (interface_init_multiqueue(tapname, mac, QUEUES, queues))
+		return -1;
+	sock = packet_open();
+	if (sock < 0) {
+		r = -1;
+		goto out;
+	}
+
+	/* A frame written to each queue arrives at the device */
+	for (i = 0; i < QUEUES; i++) {
+		uint8_t data[46] = { 'q', i };
+
+		if (interface_rx_raw(queues[i], bcast, mac, ETH_P_FPRS, data, sizeof(data)) < 0) {
+			fprintf(stderr, "queue %d: write failed\n", i);
+			r = -1;
+		}
+	}
+	while (1) {
+		struct pollfd fds = { .fd = sock, .events = POLLIN };
+		uint8_t frame[1514];
+		ssize_t len;
+
+		if (poll(&fds, 1, 1000) <= 0)
+			break;
+		len = recv(sock, frame, sizeof(frame), 0);
+		if (len < 16 || frame[12] != ETH_P_FPRS >> 8 || frame[13] != (ETH_P_FPRS & 0xff) ||
+		    frame[14] != 'q' || frame[15] >= QUEUES)
+			continue;
+		seen[frame[15]] = true;
+		for (i = 0; i < QUEUES && seen[i]; i++);
+		if (i == QUEUES)
+			break;
+	}
+	for (i = 0; i < QUEUES; i++) {
+		if (!seen[i]) {
+			fprintf(stderr, "queue %d: frame not seen by the device\n", i);
+			r = -1;
+		}
+	}
+
+	close(sock);
+out:
+	for (i = 0; i < QUEUES; i++)
+		interface_close(queues[i]);
+
+	return r;
+}
+
+#define READ_FLOWS 32
+
+static int read_flows[QUEUES];
+static int read_queue;
+
+static int read_cb(uint8_t to[6], uint8_t from[6], uint16_t eth_type, uint8_t *data, size_t len)
+{
+	/* Only our own UDP frames, the kernel may send others */
+	if (eth_type == ETH_P_IP && len >= 32 && data[28] == 'q')
+		read_flows[read_queue]++;
+
+	return 0;
+}
+
+static int test_multiqueue_read(void)
+{
+	struct interface *queues[QUEUES];
+	int sock;
+	int total = 0;
+	int r = 0;
+	int i;
+
+	if (interface_init_multiqueue(tapname, mac, QUEUES, queues))
+		return -1;
+	sock = packet_open();
+	if (sock < 0) {
+		r = -1;
+		goto out;
+	}
+
+	/* Send UDP flows out of the device. The tap spreads them over the
+	   queues by flow hash, with this many flows every queue gets some. */
+	for (i = 0; i < READ_FLOWS; i++) {
+		uint8_t frame[60] = { 0 };
+		uint8_t *ip = frame + 14;
+
+		memcpy(frame, mac, 6);
+		memcpy(frame + 6, mac, 6);
+		frame[11] ^= 1;
+		frame[12] = ETH_P_IP >> 8;
+		frame[13] = ETH_P_IP & 0xff;
+		ip[0] = 0x45;
+		ip[3] = 46;
+		ip[8] = 64;
+		ip[9] = IPPROTO_UDP;
+		ip[12] = 10; ip[15] = 1;
+		ip[16] = 10; ip[19] = 2;
+		ip[20] = 0x10; ip[21] = i;
+		ip[22] = 0x20; ip[23] = i;
+		ip[25] = 26;
+		ip[28] = 'q';
+		if (send(sock, frame, sizeof(frame), 0) != sizeof(frame)) {
+			fprintf(stderr, "could not send flow %d\n", i);
+			r = -1;
+		}
+	}
+
+	/* Each queue handle reads its own share */
+	memset(read_flows, 0, sizeof(read_flows));
+	while (total < READ_FLOWS) {
+		struct pollfd fds[QUEUES];
+
+		for (i = 0; i < QUEUES; i++) {
+			fds[i].fd = interface_fd(queues[i]);
+			fds[i].events = POLLIN;
+		}
+		if (poll(fds, QUEUES, 1000) <= 0)
+			break;
+		for (i = 0; i < QUEUES; i++) {
+			if (!(fds[i].revents & POLLIN))
+				continue;
+			read_queue = i;
+			interface_tx_raw_burst(queues[i], read_cb, INTERFACE_BURST_MAX);
+		}
+		for (total = 0, i = 0; i < QUEUES; i++)
+			total += read_flows[i];
+	}
+	if (total != READ_FLOWS) {
+		fprintf(stderr, "read %d of %d flows\n", total, READ_FLOWS);
+		r = -1;
+	}
+	for (i = 0; i < QUEUES; i++) {
+		if (!read_flows[i]) {
+			fprintf(stderr, "queue %d: read nothing\n", i);
+			r = -1;
+		}
+	}
+
+	close(sock);
+out:
+	for (i = 0; i < QUEUES; i++)
+		interface_close(queues[i]);
+
+	return r;
+}
+
+static int test_multiqueue_args(void)
+{
+	struct interface *queues[1];
+
+	if (!interface_init_multiqueue(tapname, mac, 0, queues))
+		return -1;
+	if (!interface_init_multiqueue("", mac, 1, queues))
+		return -1;
+
+	return 0;
+}
+
+struct interface_test {
+	char *name;
+	int (*func)(void);
+} tests[] = {
+	{ "multiqueue_open", test_multiqueue_open },
+	{ "multiqueue_filter", test_multiqueue_filter },
+	{ "multiqueue_ring", test_multiqueue_ring },
+	{ "multiqueue_write", test_multiqueue_write },
+	{ "multiqueue_read", test_multiqueue_read },
+	{ "multiqueue_args", test_multiqueue_args },
+};
+
+int main(int argc, char **argv)
+{
+
+	struct interface *queues[QUEUES];
+	int i;
+	int passed = 0;
+	int failed = 0;
+
+	/* Creating a tap device needs privileges, skip without them */
+	if (access("/dev/net/tun", R_OK | W_OK) ||
+	    interface_init_multiqueue(tapname, mac, QUEUES, queues)) {
+		printf("Could not create a multiqueue tap device, skipped\n");
+		return 77;
+	}
+	for (i = 0; i < QUEUES; i++)
+		interface_close(queues[i]);
+
+	for (i = 0; i < sizeof(tests)/sizeof(struct interface_test); i++) {
+		int test_ret = tests[i].func();
+
+		printf("Test: %s: %s\n", tests[i].name, test_ret ? "Failed" : "Passed");
+		if (test_ret)
+			failed++;
+		else
+			passed++;
+	}
+
+	printf("%d passed, %d failed, Result: %s\n", passed, failed, failed ? "Failed" : "Passed");
+
+	return failed;
+}
@@ -0,0 +1,484 @@
+/*
+	Copyright Jeroen Vreeken (jeroen@vreeken.net), 2026
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include "interface_xdp.h"
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef HAVE_LINUX_IF_XDP_H
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* A umem of XDP_FRAME_NR frames, the first half is given to the kernel
+   for receiving, the second half is used for sending. */
+#define XDP_FRAME_SIZE		2048
+#define XDP_FRAME_NR		4096
+#define XDP_RING_SIZE		(XDP_FRAME_NR / 2)
+
+struct xdp_ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void *desc;
+	void *map;
+	size_t map_size;
+};
+
+struct interface_xdp {
+	int fd;
+	int map_fd;
+	int prog_fd;
+	int link_fd;
+
+	uint8_t *umem;
+
+	struct xdp_ring fill;
+	struct xdp_ring comp;
+	struct xdp_ring rx;
+	struct xdp_ring tx;
+
+	uint64_t tx_free[XDP_RING_SIZE];
+	int tx_free_nr;
+	bool tx_kick;
+};
+
+static int xdp_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static struct bpf_insn xdp_insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+	return (struct bpf_insn){
+		.code = code,
+		.dst_reg = dst,
+		.src_reg = src,
+		.off = off,
+		.imm = imm,
+	};
+}
+
+/* Redirect all eth_ar frames (0x73xx) to the socket of their queue,
+   everything else goes to the network stack as usual. */
+static int xdp_prog_load(int map_fd)
+{
+	struct bpf_insn prog[] = {
+		/* r2 = ctx->rx_queue_index */
+		xdp_insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, rx_queue_index), 0),
+		/* r3 = ctx->data, r4 = ctx->data_end */
+		xdp_insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data), 0),
+		xdp_insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_4, BPF_REG_1, offsetof(struct xdp_md, data_end), 0),
+		/* if (data + 14 > data_end) goto pass */
+		xdp_insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_5, BPF_REG_3, 0, 0),
+		xdp_insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_5, 0, 0, 14),
+		xdp_insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_5, BPF_REG_4, 9, 0),
+		/* if ((ntohs(type) & 0xff00) != 0x7300) goto pass */
+		xdp_insn(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_3, 12, 0),
+		xdp_insn(BPF_ALU | BPF_END | BPF_TO_BE, BPF_REG_5, 0, 0, 16),
+		xdp_insn(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, 0xff00),
+		xdp_insn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 5, 0x7300),
+		/* return bpf_redirect_map(map, r2, XDP_PASS) */
+		xdp_insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+		xdp_insn(0, 0, 0, 0, 0),
+		xdp_insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+		xdp_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+		xdp_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+		/* pass: return XDP_PASS */
+		xdp_insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+		xdp_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+	};
+	union bpf_attr attr = { 0 };
+
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.expected_attach_type = BPF_XDP;
+	attr.insns = (uintptr_t)prog;
+	attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	attr.license = (uintptr_t)"GPL";
+
+	return xdp_bpf(BPF_PROG_LOAD, &attr);
+}
+
+static int xdp_ring_map(int fd, struct xdp_ring *ring, struct xdp_ring_offset *off, size_t desc_size, off_t pgoff)
+{
+	ring->map_size = off->desc + XDP_RING_SIZE * desc_size;
+	ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (ring->map == MAP_FAILED) {
+		ring->map = NULL;
+		return -1;
+	}
+
+	ring->producer = (void*)((uint8_t*)ring->map + off->producer);
+	ring->consumer = (void*)((uint8_t*)ring->map + off->consumer);
+	ring->flags = (void*)((uint8_t*)ring->map + off->flags);
+	ring->desc = (uint8_t*)ring->map + off->desc;
+
+	return 0;
+}
+
+static void xdp_ring_unmap(struct xdp_ring *ring)
+{
+	if (ring->map)
+		munmap(ring->map, ring->map_size);
+}
+
+static int xdp_socket(struct interface_xdp *xdp, int ifindex, int queue)
+{
+	struct xdp_umem_reg reg = { 0 };
+	struct xdp_mmap_offsets off;
+	socklen_t off_len = sizeof(off);
+	int ring_size = XDP_RING_SIZE;
+	int i;
+
+	xdp->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (xdp->fd < 0)
+		return -1;
+
+	reg.addr = (uintptr_t)xdp->umem;
+	reg.len = XDP_FRAME_SIZE * XDP_FRAME_NR;
+	reg.chunk_size = XDP_FRAME_SIZE;
+	if (setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)))
+		return -1;
+
+	if (setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) ||
+	    setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) ||
+	    setsockopt(xdp->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) ||
+	    setsockopt(xdp->fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)))
+		return -1;
+
+	if (getsockopt(xdp->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len))
+		return -1;
+
+	if (xdp_ring_map(xdp->fd, &xdp->fill, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+	    xdp_ring_map(xdp->fd, &xdp->comp, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) ||
+	    xdp_ring_map(xdp->fd, &xdp->rx, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+	    xdp_ring_map(xdp->fd, &xdp->tx, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING))
+		return -1;
+
+	/* Hand the receive half of the umem to the kernel */
+	uint64_t *fill = xdp->fill.desc;
+	for (i = 0; i < XDP_RING_SIZE; i++)
+		fill[i] = (uint64_t)i * XDP_FRAME_SIZE;
+	__atomic_store_n(xdp->fill.producer, XDP_RING_SIZE, __ATOMIC_RELEASE);
+
+	for (i = 0; i < XDP_RING_SIZE; i++)
+		xdp->tx_free[i] = (uint64_t)(XDP_RING_SIZE + i) * XDP_FRAME_SIZE;
+	xdp->tx_free_nr = XDP_RING_SIZE;
+
+	struct sockaddr_xdp sxdp = { 0 };
+
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = queue;
+	sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+	if (bind(xdp->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)))
+		return -1;
+
+	return 0;
+}
+
+static int xdp_attach(struct interface_xdp *xdp, int ifindex, int queue)
+{
+	union bpf_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = queue + 1;
+	xdp->map_fd = xdp_bpf(BPF_MAP_CREATE, &attr);
+	if (xdp->map_fd < 0)
+		return -1;
+
+	uint32_t key = queue;
+	uint32_t value = xdp->fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = xdp->map_fd;
+	attr.key = (uintptr_t)&key;
+	attr.value = (uintptr_t)&value;
+	if (xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr))
+		return -1;
+
+	xdp->prog_fd = xdp_prog_load(xdp->map_fd);
+	if (xdp->prog_fd < 0)
+		return -1;
+
+	/* The program stays attached for as long as the link is open */
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = xdp->prog_fd;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	xdp->link_fd = xdp_bpf(BPF_LINK_CREATE, &attr);
+	if (xdp->link_fd < 0)
+		return -1;
+
+	return 0;
+}
+
+struct interface_xdp *interface_xdp_init(char *name)
+{
+	struct interface_xdp *xdp;
+	char dev[IF_NAMESIZE];
+	char *colon;
+	int queue = 0;
+	int ifindex;
+
+	colon = strchr(name, ':');
+	if (colon)
+		queue = atoi(colon + 1);
+	if ((colon ? colon - name : strlen(name)) >= IF_NAMESIZE)
+		goto err_name;
+	strncpy(dev, name, IF_NAMESIZE);
+	if (colon)
+		dev[colon - name] = 0;
+
+	ifindex = if_nametoindex(dev);
+	if (!ifindex)
+		goto err_name;
+
+	xdp = calloc(1, sizeof(struct interface_xdp));
+	if (!xdp)
+		goto err_alloc;
+	xdp->fd = -1;
+	xdp->map_fd = -1;
+	xdp->prog_fd = -1;
+	xdp->link_fd = -1;
+
+	xdp->umem = mmap(NULL, XDP_FRAME_SIZE * XDP_FRAME_NR, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (xdp->umem == MAP_FAILED) {
+		xdp->umem = NULL;
+		goto err_xdp;
+	}
+
+	if (xdp_socket(xdp, ifindex, queue))
+		goto err_xdp;
+	if (xdp_attach(xdp, ifindex, queue))
+		goto err_xdp;
+
+	return xdp;
+err_xdp:
+	printf("Could not open AF_XDP socket on dev '%s' queue %d: %s\n", dev, queue, strerror(errno));
+	interface_xdp_close(xdp);
+	return NULL;
+err_name:
+	printf("Could not find dev '%s'\n", name);
+	return NULL;
+err_alloc:
+	printf("Could not allocate AF_XDP state for dev '%s'\n", name);
+	return NULL;
+}
+
+void interface_xdp_close(struct interface_xdp *xdp)
+{
+	if (xdp->link_fd >= 0)
+		close(xdp->link_fd);
+	if (xdp->prog_fd >= 0)
+		close(xdp->prog_fd);
+	if (xdp->map_fd >= 0)
+		close(xdp->map_fd);
+	xdp_ring_unmap(&xdp->fill);
+	xdp_ring_unmap(&xdp->comp);
+	xdp_ring_unmap(&xdp->rx);
+	xdp_ring_unmap(&xdp->tx);
+	if (xdp->fd >= 0)
+		close(xdp->fd);
+	if (xdp->umem)
+		munmap(xdp->umem, XDP_FRAME_SIZE * XDP_FRAME_NR);
+	free(xdp);
+}
+
+int interface_xdp_fd(struct interface_xdp *xdp)
+{
+	return xdp->fd;
+}
+
+int interface_xdp_tx(struct interface_xdp *xdp, struct interface_filter *filter, struct interface_stats *stats, size_t doff, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level), int max)
+{
+	struct xdp_desc *rx = xdp->rx.desc;
+	uint64_t *fill = xdp->fill.desc;
+	uint32_t rx_cons = *xdp->rx.consumer;
+	uint32_t fill_prod = *xdp->fill.producer;
+	uint32_t avail;
+	int nr;
+	int r = 0;
+
+	avail = __atomic_load_n(xdp->rx.producer, __ATOMIC_ACQUIRE) - rx_cons;
+	if (max && avail > max)
+		avail = max;
+
+	for (nr = 0; nr < avail && r >= 0; nr++) {
+		struct xdp_desc *desc = &rx[(rx_cons + nr) & (XDP_RING_SIZE - 1)];
+		uint8_t *data = xdp->umem + desc->addr;
+		struct eth_ar_voice_header *header = (void*)data;
+		size_t len = desc->len;
+
+		if (len <= doff) {
+			stats->tx_short++;
+		} else if (!filter || interface_filter_match(filter, data)) {
+			uint16_t eth_type = ntohs(header->type);
+
+			interface_stats_count(&stats->tx, eth_type, len);
+			r = cb(header->to, header->from, eth_type, data + doff, len - doff, header->nr, header->level);
+		}
+
+		/* The frame can be received into again.
+		   Every receive frame is either in the fill or the rx ring,
+		   so there is always room. */
+		fill[(fill_prod + nr) & (XDP_RING_SIZE - 1)] = desc->addr & ~(uint64_t)(XDP_FRAME_SIZE - 1);
+	}
+
+	__atomic_store_n(xdp->rx.consumer, rx_cons + nr, __ATOMIC_RELEASE);
+	__atomic_store_n(xdp->fill.producer, fill_prod + nr, __ATOMIC_RELEASE);
+
+	if (__atomic_load_n(xdp->fill.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)
+		recvfrom(xdp->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+
+	/* The frames are given back, but the burst stops */
+	if (r < 0)
+		return r;
+
+	/* Woken up without data, check if the socket is still usable */
+	if (!nr) {
+		int error = 0;
+		socklen_t error_len = sizeof(error);
+
+		if (getsockopt(xdp->fd, SOL_SOCKET, SO_ERROR, &error, &error_len) || error)
+			return -1;
+	}
+
+	return nr;
+}
+
+/* Collect frames the kernel has finished sending */
+static void xdp_complete(struct interface_xdp *xdp)
+{
+	uint64_t *comp = xdp->comp.desc;
+	uint32_t cons = *xdp->comp.consumer;
+	uint32_t avail = __atomic_load_n(xdp->comp.producer, __ATOMIC_ACQUIRE) - cons;
+	int i;
+
+	for (i = 0; i < avail; i++)
+		xdp->tx_free[xdp->tx_free_nr++] = comp[(cons + i) & (XDP_RING_SIZE - 1)];
+
+	__atomic_store_n(xdp->comp.consumer, cons + avail, __ATOMIC_RELEASE);
+}
+
+int interface_xdp_flush(struct interface_xdp *xdp)
+{
+	int r = 0;
+
+	if (xdp->tx_kick &&
+	    (__atomic_load_n(xdp->tx.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)) {
+		if (sendto(xdp->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) < 0 &&
+		    errno != EAGAIN && errno != EBUSY && errno != ENOBUFS)
+			r = -1;
+	}
+	xdp->tx_kick = false;
+
+	xdp_complete(xdp);
+
+	return r;
+}
+
+int interface_xdp_rx(struct interface_xdp *xdp, struct iovec *iov, int iovcnt)
+{
+	struct xdp_desc *tx = xdp->tx.desc;
+	uint32_t tx_prod = *xdp->tx.producer;
+	size_t len = 0;
+	uint8_t *data;
+	uint64_t addr;
+	int i;
+
+	if (!xdp->tx_free_nr)
+		interface_xdp_flush(xdp);
+	if (!xdp->tx_free_nr)
+		return -1;
+
+	addr = xdp->tx_free[--xdp->tx_free_nr];
+	data = xdp->umem + addr;
+	for (i = 0; i < iovcnt; i++) {
+		if (len + iov[i].iov_len > XDP_FRAME_SIZE) {
+			xdp->tx_free[xdp->tx_free_nr++] = addr;
+			return -1;
+		}
+		memcpy(data + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+
+	/* There are as many transmit frames as ring entries */
+	tx[tx_prod & (XDP_RING_SIZE - 1)] = (struct xdp_desc){
+		.addr = addr,
+		.len = len,
+	};
+	__atomic_store_n(xdp->tx.producer, tx_prod + 1, __ATOMIC_RELEASE);
+	xdp->tx_kick = true;
+
+	return 0;
+}
+
+#else /* HAVE_LINUX_IF_XDP_H */
+
+struct interface_xdp *interface_xdp_init(char *name)
+{
+	printf("AF_XDP support not available\n");
+	return NULL;
+}
+
+void interface_xdp_close(struct interface_xdp *xdp)
+{
+}
+
+int interface_xdp_fd(struct interface_xdp *xdp)
+{
+	return -1;
+}
+
+int interface_xdp_tx(struct interface_xdp *xdp, struct interface_filter *filter, struct interface_stats *stats, size_t doff, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level), int max)
+{
+	return -1;
+}
+
+int interface_xdp_rx(struct interface_xdp *xdp, struct iovec *iov, int iovcnt)
+{
+	return -1;
+}
+
+int interface_xdp_flush(struct interface_xdp *xdp)
+{
+	return -1;
+}
+
+#endif /* HAVE_LINUX_IF_XDP_H */
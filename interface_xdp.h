@@ -0,0 +1,42 @@
+/*
+	Copyright Jeroen Vreeken (jeroen@vreeken.net), 2026
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef _INCLUDE_INTERFACE_XDP_H_
+#define _INCLUDE_INTERFACE_XDP_H_
+
+#include "interface.h"
+
+#include <sys/uio.h>
+
+/* AF_XDP backend for the interface layer, used for "xdp:<dev>[:<queue>]" */
+
+struct interface_xdp;
+
+struct interface_xdp *interface_xdp_init(char *name);
+void interface_xdp_close(struct interface_xdp *xdp);
+int interface_xdp_fd(struct interface_xdp *xdp);
+
+/* Handle up to max (0: all) received frames, the data passed to cb points
+   into the shared umem. Frames not matching filter (if not NULL) are
+   skipped. */
+int interface_xdp_tx(struct interface_xdp *xdp, struct interface_filter *filter, struct interface_stats *stats, size_t doff, int (*cb)(uint8_t to[ETH_AR_MAC_SIZE], uint8_t from[ETH_AR_MAC_SIZE], uint16_t eth_type, uint8_t *data, size_t len, uint8_t transmission, uint8_t level), int max);
+
+/* Put a frame on the transmit ring, it is only sent after a flush */
+int interface_xdp_rx(struct interface_xdp *xdp, struct iovec *iov, int iovcnt);
+int interface_xdp_flush(struct interface_xdp *xdp);
+
+#endif /* _INCLUDE_INTERFACE_XDP_H_ */
@@ -0,0 +1,258 @@
+/*
+	Copyright Jeroen Vreeken (jeroen@vreeken.net), 2026
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "resample_poly.h"
+#include <string.h>
+#include <math.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* Taps per phase, a multiple of 8 for the vector code */
+#define RESAMPLE_POLY_TAPS	32
+/* Largest ratio supported */
+#define RESAMPLE_POLY_FACTOR_MAX	8
+/* Input samples handled at a time */
+#define RESAMPLE_POLY_BLOCK	256
+
+struct resample_poly {
+	/* Interpolate by up or decimate by down, one of them is 1 */
+	int up;
+	int down;
+
+	/* Coefficients in Q15, reversed for the dot product.
+	   Interpolation has up filters of RESAMPLE_POLY_TAPS,
+	   decimation one of RESAMPLE_POLY_TAPS * down. */
+	int16_t *coef;
+	int taps;
+
+	/* Input history followed by the current block */
+	int16_t *hist;
+	/* Input samples until the next decimated output */
+	int phase;
+	int16_t last;
+};
+
+static int32_t resample_poly_dot(const int16_t *x, const int16_t *h, int nr)
+{
+	int32_t sum = 0;
+	int i = 0;
+
+#if defined(__SSE2__)
+	__m128i acc = _mm_setzero_si128();
+
+	for (; i + 8 <= nr; i += 8) {
+		__m128i vx = _mm_loadu_si128((const __m128i *)(x + i));
+		__m128i vh = _mm_loadu_si128((const __m128i *)(h + i));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(vx, vh));
+	}
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	sum = _mm_cvtsi128_si32(acc);
+#elif defined(__ARM_NEON)
+	int32x4_t acc = vdupq_n_s32(0);
+
+	for (; i + 8 <= nr; i += 8) {
+		int16x8_t vx = vld1q_s16(x + i);
+		int16x8_t vh = vld1q_s16(h + i);
+		acc = vmlal_s16(acc, vget_low_s16(vx), vget_low_s16(vh));
+		acc = vmlal_s16(acc, vget_high_s16(vx), vget_high_s16(vh));
+	}
+	sum = vgetq_lane_s32(acc, 0) + vgetq_lane_s32(acc, 1) +
+	    vgetq_lane_s32(acc, 2) + vgetq_lane_s32(acc, 3);
+#endif
+	for (; i < nr; i++)
+		sum += x[i] * h[i];
+
+	return sum;
+}
+
+static int16_t resample_poly_sat(int32_t sum)
+{
+	sum = (sum + (1 << 14)) >> 15;
+	if (sum > 32767)
+		sum = 32767;
+	if (sum < -32768)
+		sum = -32768;
+	return sum;
+}
+
+/* Blackman windowed sinc lowpass below the Nyquist frequency of the
+   lower rate, at the higher rate */
+static void resample_poly_design(double *h, int nr, int factor)
+{
+	double fc = 0.425 / factor;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		double t = i - (nr - 1) / 2.0;
+		double sinc = t == 0.0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+		double w = 0.42 - 0.5 * cos(2 * M_PI * i / (nr - 1)) +
+		    0.08 * cos(4 * M_PI * i / (nr - 1));
+		h[i] = sinc * w;
+	}
+}
+
+/* Quantize nr coefficients, taken every stride, so they sum to gain */
+static void resample_poly_quantize(int16_t *coef, double *h, int nr, int stride)
+{
+	double sum = 0.0;
+	int32_t isum = 0;
+	int i, mid = 0;
+
+	for (i = 0; i < nr; i++)
+		sum += h[i * stride];
+	for (i = 0; i < nr; i++) {
+		/* Reversed, the newest sample is last in the history */
+		coef[nr - 1 - i] = lrint(h[i * stride] * 32768.0 / sum);
+		isum += coef[nr - 1 - i];
+		if (abs(coef[nr - 1 - i]) > abs(coef[mid]))
+			mid = nr - 1 - i;
+	}
+	/* Rounding error goes in the largest tap, so DC passes unchanged */
+	coef[mid] += 32768 - isum;
+}
+
+struct resample_poly *resample_poly_init(int rate_out, int rate_in)
+{
+	struct resample_poly *rp;
+	int factor;
+	int p;
+
+	if (rate_out <= 0 || rate_in <= 0 || rate_out == rate_in)
+		return NULL;
+	if (rate_out > rate_in) {
+		if (rate_out % rate_in)
+			return NULL;
+		factor = rate_out / rate_in;
+	} else {
+		if (rate_in % rate_out)
+			return NULL;
+		factor = rate_in / rate_out;
+	}
+	if (factor > RESAMPLE_POLY_FACTOR_MAX)
+		return NULL;
+
+	rp = calloc(1, sizeof(struct resample_poly));
+	if (!rp)
+		goto err_rp;
+
+	int nr = RESAMPLE_POLY_TAPS * factor;
+	double h[RESAMPLE_POLY_TAPS * RESAMPLE_POLY_FACTOR_MAX];
+
+	resample_poly_design(h, nr, factor);
+	rp->coef = calloc(nr, sizeof(int16_t));
+	if (!rp->coef)
+		goto err_coef;
+
+	if (rate_out > rate_in) {
+		rp->up = factor;
+		rp->down = 1;
+		rp->taps = RESAMPLE_POLY_TAPS;
+		for (p = 0; p < factor; p++)
+			resample_poly_quantize(rp->coef + p * RESAMPLE_POLY_TAPS, h + p,
+			    RESAMPLE_POLY_TAPS, factor);
+	} else {
+		rp->up = 1;
+		rp->down = factor;
+		rp->taps = nr;
+		resample_poly_quantize(rp->coef, h, nr, 1);
+	}
+
+	rp->hist = calloc(rp->taps + RESAMPLE_POLY_BLOCK, sizeof(int16_t));
+	if (!rp->hist)
+		goto err_hist;
+
+	resample_poly_reset(rp);
+
+	return rp;
+
+err_hist:
+	free(rp->coef);
+err_coef:
+	free(rp);
+err_rp:
+	return NULL;
+}
+
+void resample_poly_destroy(struct resample_poly *rp)
+{
+	if (!rp)
+		return;
+
+	free(rp->hist);
+	free(rp->coef);
+	free(rp);
+}
+
+int resample_poly_reset(struct resample_poly *rp)
+{
+	memset(rp->hist, 0, sizeof(int16_t) * (rp->taps + RESAMPLE_POLY_BLOCK));
+	rp->phase = rp->down - 1;
+	rp->last = 0;
+	return 0;
+}
+
+int resample_poly_perform(struct resample_poly *rp, int16_t *out, int16_t *in, int nr_out, int nr_in)
+{
+	int16_t *block = rp->hist + rp->taps - 1;
+	int o = 0;
+
+	while (nr_in) {
+		int nr = nr_in < RESAMPLE_POLY_BLOCK ? nr_in : RESAMPLE_POLY_BLOCK;
+		int i, p;
+
+		memcpy(block, in, sizeof(int16_t) * nr);
+
+		for (i = 0; i < nr; i++) {
+			/* The filter ends at the newest sample, block[i] */
+			int16_t *x = block + i - (rp->taps - 1);
+
+			if (rp->up > 1) {
+				for (p = 0; p < rp->up; p++) {
+					int16_t s = resample_poly_sat(resample_poly_dot(
+					    x, rp->coef + p * rp->taps, rp->taps));
+					if (o < nr_out)
+						out[o++] = s;
+				}
+			} else if (!rp->phase--) {
+				rp->phase = rp->down - 1;
+				int16_t s = resample_poly_sat(resample_poly_dot(
+				    x, rp->coef, rp->taps));
+				if (o < nr_out)
+					out[o++] = s;
+			}
+		}
+
+		/* Keep the newest samples as history for the next block */
+		memmove(rp->hist, rp->hist + nr, sizeof(int16_t) * (rp->taps - 1));
+
+		in += nr;
+		nr_in -= nr;
+	}
+
+	if (o)
+		rp->last = out[o - 1];
+	/* Rounding of nr_out by the caller, repeat the last sample */
+	while (o < nr_out)
+		out[o++] = rp->last;
+
+	return 0;
+}
@@ -0,0 +1,38 @@
+/*
+	Copyright Jeroen Vreeken (jeroen@vreeken.net), 2026
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef _INCLUDE_RESAMPLE_POLY_H_
+#define _INCLUDE_RESAMPLE_POLY_H_
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Polyphase FIR resampler for rates with an integer ratio (e.g. 8000,
+   16000 and 48000), in fixed point.
+   Returns NULL when the ratio is not supported. */
+struct resample_poly *resample_poly_init(int rate_out, int rate_in);
+void resample_poly_destroy(struct resample_poly *rp);
+
+int resample_poly_reset(struct resample_poly *rp);
+
+/* Consumes all nr_in samples and produces exactly nr_out, which should
+   be nr_in times the ratio. */
+int resample_poly_perform(struct resample_poly *rp, int16_t *out, int16_t *in, int nr_out, int nr_in);
+
+#endif /* _INCLUDE_RESAMPLE_POLY_H_ */
@@ -0,0 +1,167 @@
+/*
+	Copyright Jeroen Vreeken (jeroen@vreeken.net), 2026
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "resample_poly.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define TEST_MSEC 200
+
+static void test_gen(int16_t *samples, int nr, int rate, double f, double amp)
+{
+	int i;
+	
+	for (i = 0; i < nr; i++)
+		samples[i] = amp * sin(i * M_PI * 2 * f / rate);
+}
+
+/* Level of frequency f in dB relative to full scale, by Goertzel */
+static double test_level(int16_t *samples, int nr, int rate, double f)
+{
+	double coef = 2 * cos(M_PI * 2 * f / rate);
+	double s1 = 0, s2 = 0;
+	int i;
+	
+	for (i = 0; i < nr; i++) {
+		double s0 = samples[i] / 32768.0 + coef * s1 - s2;
+		s2 = s1;
+		s1 = s0;
+	}
+	double power = s1 * s1 + s2 * s2 - coef * s1 * s2;
+	
+	return 10 * log10(power / (nr * nr / 4.0) + 1e-20);
+}
+
+/* Resample a tone, the skip samples let the filter settle */
+static double test_tone(int rate_out, int rate_in, double f_in, double f_out)
+{
+	struct resample_poly *rp = resample_poly_init(rate_out, rate_in);
+	int nr_in = rate_in * TEST_MSEC / 1000;
+	int nr_out = rate_out * TEST_MSEC / 1000;
+	int16_t *in = calloc(nr_in, sizeof(int16_t));
+	int16_t *out = calloc(nr_out, sizeof(int16_t));
+	int skip = nr_out / 4;
+	
+	test_gen(in, nr_in, rate_in, f_in, 16384);
+	resample_poly_perform(rp, out, in, nr_out, nr_in);
+	double level = test_level(out + skip, nr_out - skip, rate_out, f_out);
+	
+	free(in);
+	free(out);
+	resample_poly_destroy(rp);
+	
+	return level;
+}
+
+int test(int rate_out, int rate_in)
+{
+	int low = rate_out < rate_in ? rate_out : rate_in;
+	double level;
+	
+	printf("resample_poly %d -> %d\n", rate_in, rate_out);
+	
+	/* DC and a tone in the passband pass unchanged, -6dB is our input */
+	struct resample_poly *rp = resample_poly_init(rate_out, rate_in);
+	if (!rp) {
+		printf("resample_poly_init() failed\n");
+		return -1;
+	}
+	int nr_in = rate_in / 100;
+	int nr_out = rate_out / 100;
+	int16_t in[nr_in], out[nr_out];
+	int i, j;
+	for (i = 0; i < nr_in; i++)
+		in[i] = 10000;
+	for (j = 0; j < 10; j++)
+		resample_poly_perform(rp, out, in, nr_out, nr_in);
+	for (i = 0; i < nr_out; i++) {
+		if (abs(out[i] - 10000) > 1) {
+			printf("DC: %d\n", out[i]);
+			return -1;
+		}
+	}
+	resample_poly_destroy(rp);
+	
+	level = test_tone(rate_out, rate_in, 1000, 1000);
+	printf("1000Hz: %.2fdB\n", level);
+	if (fabs(level + 6.02) > 0.5)
+		return -1;
+	
+	/* What does not fit in the lower rate is removed: aliases when
+	   decimating, images when interpolating */
+	if (rate_out < rate_in) {
+		level = test_tone(rate_out, rate_in, low - 1000, 1000);
+	} else {
+		level = test_tone(rate_out, rate_in, 1000, low - 1000);
+	}
+	printf("alias/image: %.2fdB\n", level);
+	if (level > -60)
+		return -1;
+	
+	/* Block size does not matter */
+	rp = resample_poly_init(rate_out, rate_in);
+	struct resample_poly *rp2 = resample_poly_init(rate_out, rate_in);
+	int nr_big = rate_in / 10;
+	int factor_out = rate_out > rate_in ? rate_out / rate_in : 1;
+	int factor_in = rate_in > rate_out ? rate_in / rate_out : 1;
+	int16_t big_in[nr_big];
+	int16_t big_out[nr_big * factor_out / factor_in], big_out2[nr_big * factor_out / factor_in];
+	test_gen(big_in, nr_big, rate_in, 440, 20000);
+	resample_poly_perform(rp, big_out, big_in, nr_big * factor_out / factor_in, nr_big);
+	int pos = 0, opos = 0, chunk = factor_in;
+	while (pos < nr_big) {
+		int nr = chunk;
+		if (pos + nr > nr_big)
+			nr = nr_big - pos;
+		nr -= nr % factor_in;
+		resample_poly_perform(rp2, big_out2 + opos, big_in + pos, nr * factor_out / factor_in, nr);
+		pos += nr;
+		opos += nr * factor_out / factor_in;
+		chunk = (chunk * 7 + factor_in) % 600 + factor_in;
+	}
+	if (memcmp(big_out, big_out2, sizeof(big_out))) {
+		printf("Block size changes the result\n");
+		return -1;
+	}
+	resample_poly_destroy(rp);
+	resample_poly_destroy(rp2);
+	
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (resample_poly_init(44100, 8000)) {
+		printf("resample_poly_init(44100, 8000) should fail\n");
+		return 1;
+	}
+	if (test(48000, 8000) ||
+	    test(8000, 48000) ||
+	    test(16000, 8000) ||
+	    test(8000, 16000) ||
+	    test(48000, 16000) ||
+	    test(16000, 48000)) {
+		printf("Test: Failed\n");
+		return 1;
+	}
+	printf("Test: Passed\n");
+	return 0;
+}
@@ -16,9 +16,11 @@
 
  */
 #include "sound.h"
+#include "resample_poly.h"
 #include <math.h>
 #include <endian.h>
 #include <alsa/asoundlib.h>
+#include <stdatomic.h>
 
 #include <samplerate.h>
 
@@ -30,12 +32,43 @@ static void (*sound_in_cb)(int16_t *samples_l, int16_t *samples_r, int nr_l, int
 static int channels_out = 1;
 static int channels_in = 1;
 
+/* Access the device buffer directly instead of through read/write */
+static bool mmap_access = false;
+static bool mmap_tx = false;
+static bool mmap_rx = false;
+
+/* Requested hardware buffer and period, and the resulting sizes */
+static int buffer_msec = 200;
+static int period_msec = 20;
+static int rate;
+static snd_pcm_uframes_t buffer_size_tx, period_size_tx;
+static snd_pcm_uframes_t buffer_size_rx, period_size_rx;
+
+/* Playback fill level, tuned down while there are no underruns */
+static int tune_msec = 0;
+static bool tune_done;
+static bool latency_reported;
+static snd_pcm_uframes_t tx_fill;
+
+/* Capture delay, measured by whoever runs sound_rx() */
+static _Atomic long delay_rx;
+static long tune_frames;
+static int tune_failed;
+
 struct sound_resample {
+	/* Integer ratios use our own filter, others libsamplerate */
+	struct resample_poly *poly;
 	SRC_STATE *src;
 	int rate_in;
 	int rate_out;
 	double ratio;
 	float limit;
+
+	/* Conversion buffers, they only grow */
+	float *fl_in;
+	float *fl_out;
+	int fl_in_size;
+	int fl_out_size;
 };
 
 struct sound_resample *sound_resample_create(int rate_out, int rate_in)
@@ -46,9 +79,12 @@ struct sound_resample *sound_resample_create(int rate_out, int rate_in)
 	if (!sr)
 		goto err_sr;
 
-	sr->src = src_new(SRC_LINEAR, 1, &err);
-	if (!sr->src)
-		goto err_src;
+	sr->poly = resample_poly_init(rate_out, rate_in);
+	if (!sr->poly) {
+		sr->src = src_new(SRC_LINEAR, 1, &err);
+		if (!sr->src)
+			goto err_src;
+	}
 
 	sr->ratio = (double)rate_out / (double)rate_in;
 	
@@ -67,13 +103,60 @@ void sound_resample_destroy(struct sound_resample *sr)
 	if (!sr)
 		return;
 	
-	src_delete(sr->src);
+	if (sr->poly)
+		resample_poly_destroy(sr->poly);
+	else
+		src_delete(sr->src);
+	free(sr->fl_in);
+	free(sr->fl_out);
 	free(sr);
 }
 
+void sound_resample_reset(struct sound_resample *sr)
+{
+	if (sr->poly)
+		resample_poly_reset(sr->poly);
+	else
+		src_reset(sr->src);
+}
+
+static int sound_resample_buffers(struct sound_resample *sr, int nr_out, int nr_in)
+{
+	if (nr_in > sr->fl_in_size) {
+		float *fl = realloc(sr->fl_in, sizeof(float) * nr_in);
+		if (!fl)
+			return -1;
+		sr->fl_in = fl;
+		sr->fl_in_size = nr_in;
+	}
+	if (nr_out > sr->fl_out_size) {
+		float *fl = realloc(sr->fl_out, sizeof(float) * nr_out);
+		if (!fl)
+			return -1;
+		sr->fl_out = fl;
+		sr->fl_out_size = nr_out;
+	}
+	return 0;
+}
+
+int sound_resample_reserve(struct sound_resample *sr, int nr_in)
+{
+	if (sr->poly)
+		return 0;
+	return sound_resample_buffers(sr, sound_resample_nr_out(sr, nr_in) + 1, nr_in);
+}
+
 int sound_resample_perform(struct sound_resample *sr, int16_t *out, int16_t *in, int nr_out, int nr_in)
 {
-	float fl_in[nr_in], fl_out[nr_out];
+	if (sr->poly)
+		return resample_poly_perform(sr->poly, out, in, nr_out, nr_in);
+
+	if (sound_resample_buffers(sr, nr_out, nr_in)) {
+		memset(out, 0, sizeof(int16_t) * nr_out);
+		return -1;
+	}
+
+	float *fl_in = sr->fl_in, *fl_out = sr->fl_out;
 	SRC_DATA data;
 	data.data_in = fl_in;
 	data.data_out = fl_out;
@@ -128,7 +211,17 @@ int sound_gain_limit(int16_t *samples, int nr, float gain, float *limit)
 
 int sound_resample_perform_gain_limit(struct sound_resample *sr, int16_t *out, int16_t *in, int nr_out, int nr_in, float gain)
 {
-	float fl_in[nr_in], fl_out[nr_out];
+	if (sr->poly) {
+		resample_poly_perform(sr->poly, out, in, nr_out, nr_in);
+		return sound_gain_limit(out, nr_out, gain, &sr->limit);
+	}
+
+	if (sound_resample_buffers(sr, nr_out, nr_in)) {
+		memset(out, 0, sizeof(int16_t) * nr_out);
+		return -1;
+	}
+
+	float *fl_in = sr->fl_in, *fl_out = sr->fl_out;
 	SRC_DATA data;
 	data.data_in = fl_in;
 	data.data_out = fl_out;
@@ -180,6 +273,159 @@ int sound_resample_nr_in(struct sound_resample *sr, int nr_out)
 int written;
 int failed;
 
+void sound_mmap_set(bool enable)
+{
+	mmap_access = enable;
+}
+
+void sound_latency_set(int buffer_msec_set, int period_msec_set, int tune_msec_set)
+{
+	buffer_msec = buffer_msec_set;
+	period_msec = period_msec_set;
+	tune_msec = tune_msec_set;
+}
+
+static int nr;
+
+/* Keep about fill frames queued for playback: poll() only reports room
+   once the device has played down to it. */
+static int sound_tx_fill_set(snd_pcm_uframes_t fill)
+{
+	snd_pcm_sw_params_t *sw_params;
+	int r;
+
+	snd_pcm_sw_params_malloc(&sw_params);
+	snd_pcm_sw_params_current(pcm_handle_tx, sw_params);
+	snd_pcm_sw_params_set_avail_min(pcm_handle_tx, sw_params, buffer_size_tx - fill);
+	r = snd_pcm_sw_params(pcm_handle_tx, sw_params);
+	snd_pcm_sw_params_free(sw_params);
+	if (r) {
+		printf("Could not set TX fill to %lu frames\n", (unsigned long)fill);
+		return r;
+	}
+	tx_fill = fill;
+
+	return 0;
+}
+
+void sound_latency_print(void)
+{
+	snd_pcm_sframes_t delay_tx = 0;
+	long delay = atomic_load_explicit(&delay_rx, memory_order_relaxed);
+
+	snd_pcm_delay(pcm_handle_tx, &delay_tx);
+
+	printf("TX latency: %ld frames (%ld msec), buffer %lu, period %lu, fill %lu, underruns %d\n",
+	    (long)delay_tx, (long)delay_tx * 1000 / rate,
+	    (unsigned long)buffer_size_tx, (unsigned long)period_size_tx,
+	    (unsigned long)tx_fill, failed);
+	printf("RX latency: %ld frames (%ld msec), buffer %lu, period %lu\n",
+	    delay, delay * 1000 / rate,
+	    (unsigned long)buffer_size_rx, (unsigned long)period_size_rx);
+}
+
+/* Called for each write. Reports the latency once the device runs, and
+   when tuning lowers the fill level one period per calibration window
+   without underruns. The first underrun raises it a period and ends
+   the tuning. */
+static void sound_tx_tune(int nr_written)
+{
+	snd_pcm_uframes_t step = period_size_tx ? period_size_tx : nr;
+
+	if (latency_reported && (!tune_msec || tune_done))
+		return;
+
+	tune_frames += nr_written;
+	if (tune_frames < (long)(tune_msec ? tune_msec : 1000) * rate / 1000)
+		return;
+	tune_frames = 0;
+
+	if (!latency_reported) {
+		latency_reported = true;
+		sound_latency_print();
+		tune_failed = failed;
+		return;
+	}
+
+	if (failed != tune_failed) {
+		tune_done = true;
+		if (tx_fill + step <= buffer_size_tx - nr)
+			sound_tx_fill_set(tx_fill + step);
+		printf("TX fill tuned to %lu frames after %d underruns\n",
+		    (unsigned long)tx_fill, failed - tune_failed);
+		sound_latency_print();
+	} else if (tx_fill >= nr + step) {
+		sound_tx_fill_set(tx_fill - step);
+	} else {
+		tune_done = true;
+		printf("TX fill tuned to the minimum of %lu frames\n", (unsigned long)tx_fill);
+		sound_latency_print();
+	}
+}
+
+/* Address and step (in samples) of a channel in the mmap area */
+static int16_t *sound_mmap_channel(const snd_pcm_channel_area_t *area, snd_pcm_uframes_t offset, int *step)
+{
+	*step = area->step / 16;
+	return (int16_t *)((uint8_t *)area->addr + (area->first + offset * area->step) / 8);
+}
+
+/* Interleave straight into the device buffer, NULL channels are silent */
+static int sound_out_mmap(int16_t *samples_l, int16_t *samples_r, int nr)
+{
+	int done = 0;
+
+	while (done < nr) {
+		const snd_pcm_channel_area_t *areas;
+		snd_pcm_uframes_t offset;
+		snd_pcm_uframes_t frames = nr - done;
+		snd_pcm_sframes_t r;
+		int c, i;
+
+		r = snd_pcm_avail_update(pcm_handle_tx);
+		if (r == 0) {
+			/* Full, wait like snd_pcm_writei() would */
+			snd_pcm_wait(pcm_handle_tx, -1);
+			continue;
+		}
+		if (r > 0)
+			r = snd_pcm_mmap_begin(pcm_handle_tx, &areas, &offset, &frames);
+		if (r < 0) {
+			failed++;
+			printf("recover output %d %d\n", written, failed);
+			if (snd_pcm_recover(pcm_handle_tx, r, 1) < 0)
+				return -1;
+			continue;
+		}
+
+		for (c = 0; c < channels_out; c++) {
+			int16_t *samples = c ? samples_r : samples_l;
+			int step;
+			int16_t *out = sound_mmap_channel(&areas[c], offset, &step);
+
+			for (i = 0; i < frames; i++)
+				out[i * step] = samples ? samples[done + i] : 0;
+		}
+
+		r = snd_pcm_mmap_commit(pcm_handle_tx, offset, frames);
+		if (r < 0) {
+			failed++;
+			printf("recover output %d %d\n", written, failed);
+			if (snd_pcm_recover(pcm_handle_tx, r, 1) < 0)
+				return -1;
+		}
+		done += frames;
+
+		/* Unlike snd_pcm_writei() a commit does not start the device */
+		if (snd_pcm_state(pcm_handle_tx) == SND_PCM_STATE_PREPARED)
+			snd_pcm_start(pcm_handle_tx);
+	}
+	written++;
+	sound_tx_tune(nr);
+
+	return 0;
+}
+
 static int sound_out_alsa(int16_t *play_samples, int nr)
 {
 	int r;
@@ -193,12 +439,16 @@ static int sound_out_alsa(int16_t *play_samples, int nr)
 		snd_pcm_writei (pcm_handle_tx, play_samples, nr);
 	}
 	written++;
+	sound_tx_tune(nr);
 
 	return 0;
 }
 
 int sound_out_lr(int16_t *samples_l, int16_t *samples_r, int nr)
 {
+	if (mmap_tx)
+		return sound_out_mmap(samples_l, samples_r, nr);
+
 	int16_t samples[nr * 2];
 	int i;
 	
@@ -212,6 +462,12 @@ int sound_out_lr(int16_t *samples_l, int16_t *samples_r, int nr)
 
 int sound_out(int16_t *samples, int nr, bool left, bool right)
 {
+	if (mmap_tx) {
+		if (channels_out == 2)
+			return sound_out_mmap(left ? samples : NULL, right ? samples : NULL, nr);
+		return sound_out_mmap(samples, NULL, nr);
+	}
+
 	int16_t *play_samples;
 	int16_t samples_2[nr * channels_out];
 	int i;
@@ -239,13 +495,18 @@ int sound_silence(void)
 {
 	int r;
 	
+	if (mmap_tx)
+		return sound_out_mmap(NULL, NULL, silence_nr);
+
 	r = snd_pcm_writei (pcm_handle_tx, silence, silence_nr);
 //	printf("alsa: %d\n", r);
 	if (r < 0) {
+		failed++;
 		printf("recover output\n");
 		snd_pcm_recover(pcm_handle_tx, r, 1);
 		snd_pcm_writei (pcm_handle_tx, silence, silence_nr);
 	}
+	sound_tx_tune(silence_nr);
 	return 0;
 }
 
@@ -295,7 +556,83 @@ bool sound_poll_in_rx(struct pollfd *fds, int count)
 		return false; 	
 }
 
-static int nr;
+static int sound_rx_recover(int r)
+{
+	printf("recover input (nr=%d, r=%d)\n", nr, r);
+	snd_pcm_recover(pcm_handle_rx, r, 0);
+	snd_pcm_start(pcm_handle_rx);
+
+	return -1;
+}
+
+/* Hand the device buffer to the callback, always in periods of nr
+   samples. A mono period that does not wrap around the end of the
+   buffer is passed without copying, otherwise the channels are
+   gathered into contiguous buffers. */
+static int sound_rx_mmap(void)
+{
+	int16_t rec_samples_l[nr];
+	int16_t rec_samples_r[nr];
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset;
+	snd_pcm_uframes_t frames = nr;
+	snd_pcm_sframes_t avail;
+	int16_t *samples_l, *samples_r;
+	int step_l, step_r;
+	int done = 0;
+	int i;
+	int r;
+
+	avail = snd_pcm_avail_update(pcm_handle_rx);
+	if (avail < 0)
+		return sound_rx_recover(avail);
+	if (avail < nr)
+		return 0;
+
+	r = snd_pcm_mmap_begin(pcm_handle_rx, &areas, &offset, &frames);
+	if (r < 0)
+		return sound_rx_recover(r);
+
+	samples_l = sound_mmap_channel(&areas[0], offset, &step_l);
+	if (frames == nr && channels_in == 1 && step_l == 1) {
+		sound_in_cb(samples_l, samples_l, nr, nr);
+
+		r = snd_pcm_mmap_commit(pcm_handle_rx, offset, frames);
+		if (r < 0)
+			return sound_rx_recover(r);
+		return 0;
+	}
+
+	while (1) {
+		samples_r = channels_in == 2 ? sound_mmap_channel(&areas[1], offset, &step_r) : NULL;
+		for (i = 0; i < frames; i++)
+			rec_samples_l[done + i] = samples_l[i * step_l];
+		if (samples_r) {
+			for (i = 0; i < frames; i++)
+				rec_samples_r[done + i] = samples_r[i * step_r];
+		}
+
+		r = snd_pcm_mmap_commit(pcm_handle_rx, offset, frames);
+		if (r < 0)
+			return sound_rx_recover(r);
+		done += frames;
+		if (done >= nr)
+			break;
+
+		/* The rest of the period is at the start of the buffer */
+		frames = nr - done;
+		r = snd_pcm_mmap_begin(pcm_handle_rx, &areas, &offset, &frames);
+		if (r < 0)
+			return sound_rx_recover(r);
+		if (!frames)
+			return -1;
+		samples_l = sound_mmap_channel(&areas[0], offset, &step_l);
+	}
+
+	sound_in_cb(rec_samples_l, channels_in == 2 ? rec_samples_r : rec_samples_l, nr, nr);
+
+	return 0;
+}
 
 int sound_rx(void)
 {
@@ -307,6 +644,14 @@ int sound_rx(void)
 	int16_t rec_samples_r[rec_nr];
 	int16_t *samples_l, *samples_r;
 	
+	snd_pcm_sframes_t delay;
+
+	if (!snd_pcm_delay(pcm_handle_rx, &delay))
+		atomic_store_explicit(&delay_rx, delay, memory_order_relaxed);
+
+	if (mmap_rx)
+		return sound_rx_mmap();
+
 	r = snd_pcm_readi(pcm_handle_rx, rec_samples, rec_nr);
 	
 	if (r <= 0) {
@@ -340,9 +685,20 @@ int sound_param(snd_pcm_t *pcm_handle, bool is_tx, int hw_rate, int force_channe
 	snd_pcm_hw_params_malloc (&hw_params);
 
 	snd_pcm_hw_params_any(pcm_handle, hw_params);
-	if (snd_pcm_hw_params_set_access (pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) {
+	bool mmap = false;
+	if (mmap_access) {
+		if (snd_pcm_hw_params_set_access (pcm_handle, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED))
+			printf("MMAP interleaved not supported, using read/write\n");
+		else
+			mmap = true;
+	}
+	if (!mmap && snd_pcm_hw_params_set_access (pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) {
 		printf("Interleaved not supported\n");
 	}
+	if (is_tx)
+		mmap_tx = mmap;
+	else
+		mmap_rx = mmap;
 
 	if (htole16(0x1234) == 0x1234)
 		snd_pcm_hw_params_set_format (pcm_handle, hw_params, SND_PCM_FORMAT_S16_LE);
@@ -376,8 +732,8 @@ int sound_param(snd_pcm_t *pcm_handle, bool is_tx, int hw_rate, int force_channe
 		channels_in = channels;
 	}
 
-	snd_pcm_uframes_t buffer_size = rrate / 5;
-	snd_pcm_uframes_t period_size = rrate / 50;
+	snd_pcm_uframes_t buffer_size = rrate * buffer_msec / 1000;
+	snd_pcm_uframes_t period_size = rrate * period_msec / 1000;
 
 	snd_pcm_hw_params_set_buffer_size_near (pcm_handle, hw_params, &buffer_size);
 	snd_pcm_hw_params_set_period_size_near (pcm_handle, hw_params, &period_size, NULL);
@@ -387,6 +743,19 @@ int sound_param(snd_pcm_t *pcm_handle, bool is_tx, int hw_rate, int force_channe
 		return -1;
 	}
 
+	snd_pcm_hw_params_get_buffer_size(hw_params, &buffer_size);
+	snd_pcm_hw_params_get_period_size(hw_params, &period_size, NULL);
+	printf("%s buffer: %lu frames, period: %lu frames\n", is_tx ? "TX" : "RX",
+	    (unsigned long)buffer_size, (unsigned long)period_size);
+	if (is_tx) {
+		buffer_size_tx = buffer_size;
+		period_size_tx = period_size;
+	} else {
+		buffer_size_rx = buffer_size;
+		period_size_rx = period_size;
+	}
+	rate = rrate;
+
 	snd_pcm_hw_params_free (hw_params);
 
 
@@ -471,6 +840,11 @@ int sound_set_nr(int nr_set)
 		printf("Could not set sound settings for RX\n");
 		return -1;
 	}
+	if (buffer_size_tx < nr_set * 2) {
+		printf("TX buffer holds less than two frames of %d, not tuning\n", nr_set);
+		tune_done = true;
+	}
+	tx_fill = buffer_size_tx > nr_set ? buffer_size_tx - nr_set : 0;
 
 	silence_nr = nr_set;
 	free(silence);
@@ -25,6 +25,15 @@
 int sound_out(int16_t *samples, int nr, bool left, bool right);
 int sound_out_lr(int16_t *samples_l, int16_t *samples_r, int nr);
 int sound_silence(void);
+/* Use mmap access to the device buffer if possible, call before
+   sound_init() */
+void sound_mmap_set(bool enable);
+/* Hardware buffer and period size, and the calibration window for
+   tuning the playback fill level (0: off). Call before sound_init() */
+void sound_latency_set(int buffer_msec, int period_msec, int tune_msec);
+/* Print the measured delay of both directions, call from the tx thread.
+   The rx delay is the one last seen by sound_rx(). */
+void sound_latency_print(void);
 /* Returns hw_rate or negative error*/
 int sound_init(char *device, 
     void (*in_cb)(int16_t *samples_l, int16_t *samples_r, int nr_l, int nr_r),
@@ -42,6 +51,11 @@ struct sound_resample;
 
 struct sound_resample *sound_resample_create(int rate_out, int rate_in);
 void sound_resample_destroy(struct sound_resample *sr);
+/* Forget earlier input, for reuse on another stream */
+void sound_resample_reset(struct sound_resample *sr);
+/* Size the conversion buffers for nr_in samples in, so perform does
+   not need to allocate */
+int sound_resample_reserve(struct sound_resample *sr, int nr_in);
 int sound_resample_perform(struct sound_resample *sr, int16_t *out, int16_t *in, int nr_out, int nr_in);
 int sound_resample_perform_gain_limit(struct sound_resample *sr, int16_t *out, int16_t *in, int nr_out, int nr_in, float gain);
 int sound_resample_nr_out(struct sound_resample *sr, int nr_in);
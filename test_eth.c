@@ -42,8 +42,8 @@ int main(int argc, char **argv)
 		printf("Callsign could not be converted to a valid MAC address\n");
 		return -1;
 	}
-	int fd_int = interface_init(netname, mac, true, 0);
-	if (fd_int < 0) {
+	struct interface *iface = interface_init(netname, mac, true, 0);
+	if (!iface) {
 		printf("Could not create interface\n");
 		return -1;
 	}
@@ -67,7 +67,7 @@ int main(int argc, char **argv)
 		
 		int nr;
 		for (nr = 0; nr < b->nr; nr += NR_SAMPLES) {
-			interface_rx(bcast, mac, ETH_P_NATIVE16, 
+			interface_rx(iface, bcast, mac, ETH_P_NATIVE16, 
 			    (uint8_t*)(b->samples+nr), 2*NR_SAMPLES,
 			    transmission, level);
 		}
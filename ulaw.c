@@ -76,11 +76,24 @@ static inline int val_seg(int val)
  * For further information see John C. Bellamy's Digital Telephony, 1982,
  * John Wiley & Sons, pps 98-111 and 472-476.
  */
-static uint8_t linear2ulaw(int16_t pcm_val)	/* 2's complement (16-bit range) */
+/* u-law code for a biased magnitude, not yet complemented */
+static uint8_t biased2ulaw(int pcm_val)
 {
-	int mask;
 	int seg;
-	unsigned char uval;
+
+	/* Convert the scaled magnitude to segment number. */
+	seg = val_seg(pcm_val);
+
+	/*
+	 * Combine the segment and quantization bits.
+	 */
+	return (seg << 4) | ((pcm_val >> (seg + 3)) & 0xF);
+}
+
+static uint8_t linear2ulaw(int16_t sample)	/* 2's complement (16-bit range) */
+{
+	int pcm_val = sample;
+	int mask;
 
 	/* Get the sign and the magnitude of the value. */
 	if (pcm_val < 0) {
@@ -93,15 +106,8 @@ static uint8_t linear2ulaw(int16_t pcm_val)	/* 2's complement (16-bit range) */
 	if (pcm_val > 0x7FFF)
 		pcm_val = 0x7FFF;
 
-	/* Convert the scaled magnitude to segment number. */
-	seg = val_seg(pcm_val);
-
-	/*
-	 * Combine the sign, segment, quantization bits;
-	 * and complement the code word.
-	 */
-	uval = (seg << 4) | ((pcm_val >> (seg + 3)) & 0xF);
-	return uval ^ mask;
+	/* Add the sign and complement the code word. */
+	return biased2ulaw(pcm_val) ^ mask;
 }
 
 /*
@@ -130,7 +136,7 @@ static int16_t ulaw2linear(uint8_t u_val)
 	return ((u_val & SIGN_BIT) ? (BIAS - t) : (t - BIAS));
 }
 
-void ulaw_decode(int16_t *samples, uint8_t *ulaw, int nr)
+void ulaw_decode_ref(int16_t *samples, uint8_t *ulaw, int nr)
 {
 	int i;
 	
@@ -139,7 +145,7 @@ void ulaw_decode(int16_t *samples, uint8_t *ulaw, int nr)
 	}
 }
 
-void ulaw_encode(uint8_t *ulaw, int16_t *samples, int nr)
+void ulaw_encode_ref(uint8_t *ulaw, int16_t *samples, int nr)
 {
 	int i;
 	
@@ -147,3 +153,48 @@ void ulaw_encode(uint8_t *ulaw, int16_t *samples, int nr)
 		ulaw[i] = linear2ulaw(samples[i]);
 	}
 }
+
+/*
+ * Table driven versions, the tables are filled from the code above when
+ * the library is loaded.
+ * The code only depends on the sign and the top 12 bits of the biased
+ * magnitude, so encoding is a lookup in a 4k table.
+ */
+
+static int16_t ulaw_decode_table[256];
+static uint8_t ulaw_encode_table[0x8000 >> 3];
+
+static void __attribute__((constructor)) ulaw_tables_init(void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++)
+		ulaw_decode_table[i] = ulaw2linear(i);
+	for (i = 0; i < sizeof(ulaw_encode_table); i++)
+		ulaw_encode_table[i] = biased2ulaw(i << 3);
+}
+
+void ulaw_decode(int16_t *samples, uint8_t *ulaw, int nr)
+{
+	int i;
+	
+	for (i = 0; i < nr; i++) {
+		samples[i] = ulaw_decode_table[ulaw[i]];
+	}
+}
+
+void ulaw_encode(uint8_t *ulaw, int16_t *samples, int nr)
+{
+	int i;
+	
+	for (i = 0; i < nr; i++) {
+		int pcm_val = samples[i];
+		/* 0 or -1, without branches */
+		int sign = pcm_val >> 31;
+		int mag = ((pcm_val ^ sign) - sign) + BIAS;
+
+		if (mag > 0x7FFF)
+			mag = 0x7FFF;
+		ulaw[i] = ulaw_encode_table[mag >> 3] ^ (0xFF ^ (sign & 0x80));
+	}
+}